@@ -0,0 +1,85 @@
+#include "quadtree.h"
+#include "linear_quadtree.h"
+
+/*
+ * The query paths of quad_tree and linear_quadtree, each behind a function
+ * of its own, compiled (not linked) by 'make asm-check' to compare their
+ * code with that of another revision: built with the default policies,
+ * they should not change when only instrumentation is added.
+ */
+
+template< typename T >
+class probe_object
+{
+public:
+
+    probe_object( T x, T y, T w, T h )
+
+        : x_( x ), y_( y ), w_( w ), h_( h )
+    {}
+
+    T       x() const       { return x_; }
+    T       y() const       { return y_; }
+    T       width() const   { return w_; }
+    T       height() const  { return h_; }
+
+private:
+
+    T       x_;
+    T       y_;
+    T       w_;
+    T       h_;
+};
+
+typedef probe_object< int >                 probe_type;
+typedef quad_tree< probe_type >             probe_tree;
+typedef linear_quadtree< probe_type >       probe_linear_tree;
+
+struct probe_counter
+{
+    void operator()( const probe_type & ) const { ++n; }
+    bool active() const                         { return n < 10; }
+
+    int & n;
+};
+
+template< typename Tree_type >
+int probe_common( const Tree_type & t, const rectangle< int > & r, const point< int > & p, const line_segment< int > & l )
+{
+    int n = 0;
+    probe_counter f = { n };
+
+    t.for_each_match( r, f );
+    t.for_each_match( p, f );
+    t.line_intersect( l, f );
+    t.first_line_intersect( l, f );
+    t.within_radius( p, 50, f );
+
+    return n + ( t.raycast( l ).object != nullptr );
+}
+
+int probe_quad_tree( const probe_tree & t, const rectangle< int > & r, const point< int > & p, const line_segment< int > & l )
+{
+    int n = probe_common( t, r, p, l );
+    probe_counter f = { n };
+
+    probe_tree::result_type found;
+    t.retrieve( r, found );
+
+    t.for_each_match_iterative( r, f );
+    t.for_each_overlap( r, f );
+    t.line_intersect_iterative( l, f );
+    t.nearest( p, 8, f );
+
+    return n + int( found.size() );
+}
+
+int probe_linear_quadtree( const probe_linear_tree & t, const rectangle< int > & r, const point< int > & p, const line_segment< int > & l )
+{
+    int n = probe_common( t, r, p, l );
+    probe_counter f = { n };
+
+    t.for_each_match_ranges( r, f );
+
+    return n;
+}
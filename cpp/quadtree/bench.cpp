@@ -0,0 +1,909 @@
+#include "quadtree.h"
+#include "concurrent_quadtree.h"
+#include "hilbert.h"
+#include "linear_quadtree.h"
+#include "orthtree.h"
+#include "quadtree_view.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * The spatial index benchmark: builds quad_tree (sweeping max_levels and
+ * max_objects), linear_quadtree (sweeping max_levels) and a brute-force
+ * scan over datasets of 10K objects up to 10M, and times box, point and
+ * segment queries against each, one query at a time.
+ *
+ *     bench [csv file] [largest object count] [queries per kind]
+ *
+ * defaulting to bench.csv, 10000000 and 1000. Each row of the CSV holds one
+ * structure's build and one kind of query:
+ *
+ *     dataset, objects, structure, max_levels, max_objects, build_ms,
+ *     memory_bytes, peak_bytes, nodes, query, queries, p50_us, p99_us,
+ *     mean_us, mean_hits
+ *
+ * memory_bytes is the heap the structure holds once built, peak_bytes the
+ * most it held at once while being built. Every structure reports its
+ * candidates to the same exact test, so mean_hits agrees between them (and
+ * is checked to, over the queries the brute-force scan runs).
+ *
+ * Before the sweep, a few comparisons between the variants of a structure
+ * are printed (see bench_concurrent_insert and those after it).
+ */
+
+// the heap in use (and its peak), counted in a header before each block;
+// atomic, as concurrent_quad_tree allocates from several threads at once
+static std::atomic< std::size_t > live_bytes( 0 );
+static std::atomic< std::size_t > peak_bytes( 0 );
+
+static const std::size_t header_size = 16;
+
+void * operator new( std::size_t n )
+{
+    if ( char * p = static_cast< char * >( std::malloc( n + header_size )))
+    {
+        *reinterpret_cast< std::size_t * >( p ) = n;
+
+        const std::size_t live = live_bytes += n;
+        std::size_t peak = peak_bytes;
+
+        while ( live > peak && !peak_bytes.compare_exchange_weak( peak, live ))
+            ;
+
+        return p + header_size;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete( void * p ) noexcept
+{
+    if ( !p ) return;
+
+    char * block = static_cast< char * >( p ) - header_size;
+
+    live_bytes -= *reinterpret_cast< std::size_t * >( block );
+    std::free( block );
+}
+
+template< typename T >
+class bench_object
+{
+public:
+
+    bench_object( T x, T y, T w, T h, int data )
+
+        : x_( x ), y_( y ), w_( w ), h_( h ), data_( data )
+    {}
+
+    T       x() const       { return x_; }
+    T       y() const       { return y_; }
+    T       width() const   { return w_; }
+    T       height() const  { return h_; }
+    int     data() const    { return data_; }
+
+private:
+
+    T       x_;
+    T       y_;
+    T       w_;
+    T       h_;
+    int     data_;
+};
+
+typedef point< int >            bench_point;
+typedef line_segment< int >     bench_line;
+typedef rectangle< int >        bench_rectangle;
+
+// the side of the (square) world every dataset lies in
+static const int world = 1 << 20;
+
+/*
+ * The exact tests applied to every candidate a structure reports: the
+ * trees report the objects of every node a query reaches, so these decide
+ * which are hits. Boxes are closed, as in the trees.
+ */
+bool overlaps( const bench_object< int > & o, const bench_rectangle & r )
+{
+    return o.x() <= r.x() + r.width() && r.x() <= o.x() + o.width() &&
+           o.y() <= r.y() + r.height() && r.y() <= o.y() + o.height();
+}
+
+bool overlaps( const bench_object< int > & o, const bench_point & p )
+{
+    return o.x() <= p.x() && p.x() <= o.x() + o.width() &&
+           o.y() <= p.y() && p.y() <= o.y() + o.height();
+}
+
+bool overlaps( const bench_object< int > & o, const bench_line & l )
+{
+    return has_intersect( l, bench_rectangle( o.x(), o.y(), o.width(), o.height() ));
+}
+
+/*
+ * A scan of every object, with the query surface of the trees, as the
+ * baseline they are measured against.
+ */
+class brute_force
+{
+public:
+
+    brute_force( const std::vector< bench_object< int > > & objects )
+
+        : objects_( objects )
+    {}
+
+    template< typename Query_type, typename Functor_type >
+    void for_each_match( const Query_type & q, const Functor_type & f ) const
+    {
+        for ( const bench_object< int > & o : objects_ )
+        {
+            if ( overlaps( o, q )) f( o );
+        }
+    }
+
+    template< typename Functor_type >
+    void line_intersect( const bench_line & l, const Functor_type & f ) const
+    {
+        for_each_match( l, f );
+    }
+
+private:
+
+    std::vector< bench_object< int > > objects_;
+};
+
+// datasets
+
+int clamp_to_world( double v, int size )
+{
+    return int( std::min( std::max( v, 0.0 ), double( world - 1 - size )));
+}
+
+// boxes of up to 64 units a side, anywhere
+std::vector< bench_object< int > > uniform_dataset( std::size_t n, std::mt19937 & rng )
+{
+    std::uniform_int_distribution< int > position( 0, world - 65 );
+    std::uniform_int_distribution< int > size( 0, 64 );
+
+    std::vector< bench_object< int > > objects;
+    objects.reserve( n );
+
+    for ( std::size_t i = 0; i < n; ++i )
+    {
+        objects.emplace_back( position( rng ), position( rng ), size( rng ), size( rng ), int( i ));
+    }
+
+    return objects;
+}
+
+// the same boxes, about 32 Gaussian blobs of differing spread
+std::vector< bench_object< int > > clustered_dataset( std::size_t n, std::mt19937 & rng )
+{
+    const int blobs = 32;
+
+    std::uniform_real_distribution< double > centre( 0.05 * world, 0.95 * world );
+    std::uniform_real_distribution< double > spread( 0.002 * world, 0.03 * world );
+    std::uniform_int_distribution< int > blob( 0, blobs - 1 );
+    std::uniform_int_distribution< int > size( 0, 64 );
+    std::normal_distribution< double > offset( 0.0, 1.0 );
+
+    std::vector< double > cx, cy, sigma;
+
+    for ( int b = 0; b < blobs; ++b )
+    {
+        cx.push_back( centre( rng ));
+        cy.push_back( centre( rng ));
+        sigma.push_back( spread( rng ));
+    }
+
+    std::vector< bench_object< int > > objects;
+    objects.reserve( n );
+
+    for ( std::size_t i = 0; i < n; ++i )
+    {
+        const int b = blob( rng );
+        const int w = size( rng ), h = size( rng );
+
+        objects.emplace_back( clamp_to_world( cx[ b ] + sigma[ b ] * offset( rng ), w ),
+                              clamp_to_world( cy[ b ] + sigma[ b ] * offset( rng ), h ),
+                              w, h, int( i ));
+    }
+
+    return objects;
+}
+
+/*
+ * The bounding boxes of the segments of roads: polylines of 100 segments of
+ * 50 - 400 units, which mostly run straight (on a grid-like heading, with a
+ * little drift) and now and then turn a corner, so that the boxes are thin,
+ * long and lie along one another as those of a road network do.
+ */
+std::vector< bench_object< int > > road_dataset( std::size_t n, std::mt19937 & rng )
+{
+    const double pi = 3.14159265358979323846;
+    const std::size_t segments_per_road = 100;
+
+    std::uniform_real_distribution< double > start( 0.0, world - 1.0 );
+    std::uniform_real_distribution< double > length( 50.0, 400.0 );
+    std::uniform_real_distribution< double > drift( -0.05, 0.05 );
+    std::uniform_real_distribution< double > chance( 0.0, 1.0 );
+    std::uniform_int_distribution< int > heading( 0, 3 );
+
+    std::vector< bench_object< int > > objects;
+    objects.reserve( n );
+
+    while ( objects.size() < n )
+    {
+        double x = start( rng ), y = start( rng );
+        double angle = heading( rng ) * pi / 2;
+
+        for ( std::size_t s = 0; s < segments_per_road && objects.size() < n; ++s )
+        {
+            if ( chance( rng ) < 0.1 )
+                angle += chance( rng ) < 0.5 ? pi / 2 : -pi / 2;
+
+            angle += drift( rng );
+
+            const double d = length( rng );
+            double x2 = x + d * std::cos( angle ), y2 = y + d * std::sin( angle );
+
+            // roads turn back at the edge of the world
+            if ( x2 < 0 || x2 > world - 1 || y2 < 0 || y2 > world - 1 )
+            {
+                angle += pi;
+                x2 = std::min( std::max( x2, 0.0 ), world - 1.0 );
+                y2 = std::min( std::max( y2, 0.0 ), world - 1.0 );
+            }
+
+            const bench_rectangle r = make_bounding_box( bench_point( int( x ), int( y )), bench_point( int( x2 ), int( y2 )));
+            objects.emplace_back( r.x(), r.y(), r.width(), r.height(), int( objects.size() ));
+
+            x = x2;
+            y = y2;
+        }
+    }
+
+    return objects;
+}
+
+/*
+ * The queries of each kind, centred on randomly chosen objects so that
+ * they fall where the data is: boxes, and segments four times as long as
+ * the boxes are wide, sized to hold about 16 objects of a uniform dataset
+ * of the same size; and points at the corner of an object.
+ */
+struct query_set
+{
+    std::vector< bench_rectangle >  boxes;
+    std::vector< bench_point >      points;
+    std::vector< bench_line >       segments;
+};
+
+query_set make_queries( const std::vector< bench_object< int > > & objects, int count, std::mt19937 & rng )
+{
+    const double pi = 3.14159265358979323846;
+    const int side = std::max( 1, int( world * std::sqrt( 16.0 / objects.size() )));
+
+    std::uniform_int_distribution< std::size_t > pick( 0, objects.size() - 1 );
+    std::uniform_real_distribution< double > direction( 0.0, 2 * pi );
+
+    query_set q;
+
+    for ( int i = 0; i < count; ++i )
+    {
+        const bench_object< int > & b = objects[ pick( rng ) ];
+        q.boxes.emplace_back( clamp_to_world( b.x() - side / 2, side ), clamp_to_world( b.y() - side / 2, side ), side, side );
+
+        const bench_object< int > & p = objects[ pick( rng ) ];
+        q.points.emplace_back( p.x(), p.y() );
+
+        const bench_object< int > & s = objects[ pick( rng ) ];
+        const double a = direction( rng );
+        q.segments.emplace_back( bench_point( s.x(), s.y() ),
+                                 bench_point( clamp_to_world( s.x() + 4.0 * side * std::cos( a ), 0 ),
+                                              clamp_to_world( s.y() + 4.0 * side * std::sin( a ), 0 )));
+    }
+
+    return q;
+}
+
+// measurement
+
+struct build_stats
+{
+    std::string     structure;
+    int             max_levels;
+    int             max_objects;
+    double          build_ms;
+    std::size_t     memory_bytes;
+    std::size_t     peak_bytes;
+    long long       nodes;
+};
+
+struct query_stats
+{
+    double          p50_us;
+    double          p99_us;
+    double          mean_us;
+    double          mean_hits;
+    long long       checked_hits;   // over the first 'checked' queries
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+double microseconds( bench_clock::duration d )
+{
+    return std::chrono::duration< double, std::micro >( d ).count();
+}
+
+// the nth percentile of latencies sorted in ascending order
+double percentile( const std::vector< double > & sorted, double nth )
+{
+    const std::size_t i = std::size_t( nth / 100.0 * ( sorted.size() - 1 ) + 0.5 );
+
+    return sorted[ std::min( i, sorted.size() - 1 ) ];
+}
+
+template< typename Query_type >
+struct run_query;
+
+template<>
+struct run_query< bench_rectangle >
+{
+    static const char * name() { return "box"; }
+
+    template< typename Index_type, typename Functor_type >
+    static void run( const Index_type & index, const bench_rectangle & q, const Functor_type & f )
+    {
+        index.for_each_match( q, f );
+    }
+};
+
+template<>
+struct run_query< bench_point >
+{
+    static const char * name() { return "point"; }
+
+    template< typename Index_type, typename Functor_type >
+    static void run( const Index_type & index, const bench_point & q, const Functor_type & f )
+    {
+        index.for_each_match( q, f );
+    }
+};
+
+template<>
+struct run_query< bench_line >
+{
+    static const char * name() { return "segment"; }
+
+    template< typename Index_type, typename Functor_type >
+    static void run( const Index_type & index, const bench_line & q, const Functor_type & f )
+    {
+        index.line_intersect( q, f );
+    }
+};
+
+/*
+ * Times each of the first 'count' queries on its own, counting the
+ * candidates which pass the exact test.
+ */
+template< typename Index_type, typename Query_type >
+query_stats time_queries( const Index_type & index, const std::vector< Query_type > & queries,
+                          std::size_t count, std::size_t checked )
+{
+    std::vector< double > latencies;
+    latencies.reserve( count );
+
+    long long hits = 0;
+    query_stats stats = {};
+
+    for ( std::size_t i = 0; i < count; ++i )
+    {
+        const Query_type & q = queries[ i ];
+        long long n = 0;
+
+        const bench_clock::time_point start = bench_clock::now();
+        run_query< Query_type >::run( index, q, [&]( const bench_object< int > & o ) { n += overlaps( o, q ); } );
+        latencies.push_back( microseconds( bench_clock::now() - start ));
+
+        hits += n;
+
+        if ( i < checked ) stats.checked_hits += n;
+    }
+
+    double total = 0;
+
+    for ( double l : latencies ) total += l;
+
+    std::sort( latencies.begin(), latencies.end() );
+
+    stats.p50_us = percentile( latencies, 50 );
+    stats.p99_us = percentile( latencies, 99 );
+    stats.mean_us = total / count;
+    stats.mean_hits = double( hits ) / count;
+
+    return stats;
+}
+
+/*
+ * Writes the CSV rows of one built structure: one per kind of query, with
+ * the brute-force scan's hit counts (the reference, from the first run
+ * of each dataset) checked against this structure's over the queries the
+ * scan ran.
+ */
+class bench_writer
+{
+public:
+
+    bench_writer( std::ostream & csv, const std::string & dataset, std::size_t objects,
+                  const query_set & queries, std::size_t count, std::size_t checked )
+
+        : csv_( csv )
+        , dataset_( dataset )
+        , objects_( objects )
+        , queries_( queries )
+        , count_( count )
+        , checked_( checked )
+    {}
+
+    template< typename Index_type >
+    void run( const Index_type & index, const build_stats & build )
+    {
+        // the brute-force scan is too slow to run every query on large data
+        const std::size_t count = build.structure == "brute_force" ? checked_ : count_;
+
+        write( build, run_query< bench_rectangle >::name(), count, time_queries( index, queries_.boxes, count, checked_ ), 0 );
+        write( build, run_query< bench_point >::name(), count, time_queries( index, queries_.points, count, checked_ ), 1 );
+        write( build, run_query< bench_line >::name(), count, time_queries( index, queries_.segments, count, checked_ ), 2 );
+    }
+
+private:
+
+    void write( const build_stats & build, const char * query, std::size_t count, const query_stats & stats, int kind )
+    {
+        if ( build.structure == "brute_force" )
+            reference_[ kind ] = stats.checked_hits;
+        else
+            assert( stats.checked_hits == reference_[ kind ] );
+
+        csv_ << dataset_ << "," << objects_ << "," << build.structure << ","
+             << build.max_levels << "," << build.max_objects << "," << build.build_ms << ","
+             << build.memory_bytes << "," << build.peak_bytes << ",";
+
+        if ( build.nodes >= 0 ) csv_ << build.nodes;
+
+        csv_ << "," << query << "," << count << "," << stats.p50_us << "," << stats.p99_us << ","
+             << stats.mean_us << "," << stats.mean_hits << "\n";
+
+        csv_.flush();
+    }
+
+    std::ostream &              csv_;
+    std::string                 dataset_;
+    std::size_t                 objects_;
+    const query_set &           queries_;
+    std::size_t                 count_;
+    std::size_t                 checked_;
+    long long                   reference_[ 3 ] = { 0, 0, 0 };
+};
+
+/*
+ * Builds an index with make(), measuring the time taken, the heap it
+ * holds afterwards and the most it held at once meanwhile, then hands it
+ * to the writer.
+ */
+template< typename Index_type, typename Make_type, typename Nodes_type >
+void bench_index( bench_writer & writer, build_stats build, const Make_type & make, const Nodes_type & nodes )
+{
+    const std::size_t before = live_bytes;
+    peak_bytes = before;
+
+    const bench_clock::time_point start = bench_clock::now();
+    std::unique_ptr< Index_type > index( make() );
+    const bench_clock::time_point end = bench_clock::now();
+
+    build.build_ms = std::chrono::duration< double, std::milli >( end - start ).count();
+    build.memory_bytes = live_bytes - before;
+    build.peak_bytes = peak_bytes - before;
+    build.nodes = nodes( *index );
+
+    cout << build.structure << " levels " << build.max_levels << " objects " << build.max_objects
+         << " : built in " << build.build_ms << " ms, " << build.memory_bytes << " bytes" << endl;
+
+    writer.run( *index, build );
+}
+
+void bench_dataset( std::ostream & csv, const std::string & name,
+                    const std::function< std::vector< bench_object< int > >( std::size_t, std::mt19937 & ) > & generate,
+                    std::size_t n, int query_count )
+{
+    typedef quad_tree< bench_object< int > >           quad_tree_type;
+    typedef linear_quadtree< bench_object< int > >     linear_quadtree_type;
+
+    static const int levels[] = { 8, 12, 16 };
+    static const int max_objects[] = { 8, 32, 128 };
+
+    std::mt19937 rng( 42 );
+
+    const std::vector< bench_object< int > > objects = generate( n, rng );
+    const query_set queries = make_queries( objects, query_count, rng );
+
+    // about 2 * 10^8 objects tested per kind of query, at most
+    const std::size_t checked = std::min< std::size_t >( query_count, std::max< std::size_t >( 20, 200000000 / n ));
+
+    cout << "dataset " << name << ", " << n << " objects" << endl;
+
+    bench_writer writer( csv, name, n, queries, query_count, checked );
+    const bench_rectangle bounds( 0, 0, world, world );
+
+    bench_index< brute_force >( writer, { "brute_force", 0, 0, 0, 0, 0, -1 },
+        [&]() { return new brute_force( objects ); },
+        []( const brute_force & ) { return -1ll; } );
+
+    for ( int l : levels )
+    {
+        bench_index< linear_quadtree_type >( writer, { "linear_quadtree", l, 0, 0, 0, 0, -1 },
+            [&]() { return new linear_quadtree_type( bounds, l, objects.begin(), objects.end() ); },
+            []( const linear_quadtree_type & ) { return -1ll; } );
+
+        for ( int m : max_objects )
+        {
+            bench_index< quad_tree_type >( writer, { "quad_tree", l, m, 0, 0, 0, -1 },
+                [&]() { return new quad_tree_type( bounds, l, m, objects.begin(), objects.end() ); },
+                []( const quad_tree_type & t ) { return (long long) t.node_count(); } );
+        }
+    }
+}
+
+/*
+ * Comparisons between variants of one structure, on the 1000 x 1000 world
+ * of main.cpp's demo, printed rather than written to the CSV: concurrent
+ * against mutex-guarded insertion, building a tree against opening its
+ * saved image, Morton against Hilbert order, and orth_tree against
+ * quad_tree. Each checks that the variants it times agree.
+ */
+
+// 'count' 10 x 10 objects scattered over the demo's world
+std::vector< bench_object<int> > scattered_objects( int count )
+{
+    std::mt19937 rng( 1 );
+    std::uniform_int_distribution< int > position( 0, 989 );
+    std::vector< bench_object<int> > objects;
+
+    for ( int i = 0; i < count; ++i )
+    {
+        objects.push_back( bench_object<int>( position( rng ), position( rng ), 10, 10, i ));
+    }
+
+    return objects;
+}
+
+// the time to build a large tree, against that to open its saved image
+// and answer a first query
+void bench_save_view( int n = 200000 )
+{
+    typedef chrono::duration< double, std::milli > ms;
+
+    const char * path = "quadtree.image";
+    const std::vector< bench_object<int> > objects = scattered_objects( n );
+    const auto bb = make_bounding_box( point<int>( 400, 400 ), point<int>( 420, 420 ));
+    int matches = 0;
+
+    auto start = chrono::high_resolution_clock::now();
+    quad_tree< bench_object<int> > qtree( { 0, 0, 1000, 1000 }, 10, 10, objects.begin(), objects.end() );
+    qtree.for_each_match( bb, [&]( const bench_object<int> & ) { ++matches; } );
+    auto built = chrono::high_resolution_clock::now();
+
+    qtree.save( path );
+
+    auto opening = chrono::high_resolution_clock::now();
+    const quad_tree_view< bench_object<int> > view = quad_tree_view< bench_object<int> >::open( path );
+    view.for_each_match( bb, [&]( const bench_object<int> & ) { --matches; } );
+    auto opened = chrono::high_resolution_clock::now();
+
+    cout << "(view)- objects : " << n << ", build and query ms : " << ms( built - start ).count()
+         << ", open and query ms : " << ms( opened - opening ).count() << endl;
+    assert( matches == 0 );
+
+    std::remove( path );
+}
+
+// insert throughput from 1 to 8 threads, into a concurrent_quad_tree and
+// into a quad_tree behind a single mutex
+void bench_concurrent_insert( int n = 200000 )
+{
+    const rectangle<int> world( 0, 0, 1000, 1000 );
+    const std::vector< bench_object<int> > objects = scattered_objects( n );
+
+    for ( unsigned threads = 1; threads <= 8; threads *= 2 )
+    {
+        double rate[ 2 ];
+
+        for ( int locked = 0; locked < 2; ++locked )
+        {
+            concurrent_quad_tree< bench_object<int> > ctree( world, 10, 10 );
+            quad_tree< bench_object<int> > qtree( world, 10, 10 );
+            std::mutex m;
+
+            auto start = chrono::high_resolution_clock::now();
+
+            detail::run_workers( threads, [&]( unsigned worker )
+            {
+                for ( std::size_t i = worker; i < objects.size(); i += threads )
+                {
+                    if ( locked )
+                    {
+                        std::lock_guard< std::mutex > lock( m );
+                        qtree.insert( objects[ i ] );
+                    }
+                    else
+                        ctree.insert( objects[ i ] );
+                }
+            });
+
+            auto end = chrono::high_resolution_clock::now();
+            rate[ locked ] = n / chrono::duration_cast< chrono::duration< double > >( end - start ).count();
+        }
+
+        cout << "(concurrent insert)- threads : " << threads << ", inserts/sec : " << long( rate[ 0 ] )
+             << ", with a global mutex : " << long( rate[ 1 ] ) << endl;
+    }
+}
+
+// where a query's matches lie in a linear_quadtree's object array: the runs
+// of adjacent objects they form, and the cache lines those runs span (the
+// lines a query must fetch, with a cold cache), summed over the queries
+struct match_locality
+{
+    std::size_t matches;
+    std::size_t runs;
+    std::size_t lines;
+    double      ms;
+};
+
+template< typename Tree_type >
+match_locality measure_locality( const Tree_type & tree, const std::vector< rectangle<int> > & queries )
+{
+    typedef typename Tree_type::value_type T;
+
+    match_locality result = { 0, 0, 0, 0.0 };
+    std::vector< std::uintptr_t > hits;
+
+    for ( const rectangle<int> & r : queries )
+    {
+        hits.clear();
+        tree.for_each_match( r, [&hits]( const T & obj ) { hits.push_back( reinterpret_cast< std::uintptr_t >( &obj )); } );
+        std::sort( hits.begin(), hits.end() );
+
+        std::uintptr_t last_line = 0;
+
+        for ( std::size_t i = 0; i < hits.size(); ++i )
+        {
+            if ( i == 0 || hits[ i ] != hits[ i - 1 ] + sizeof( T ))
+                ++result.runs;
+
+            for ( std::uintptr_t line = hits[ i ] / 64; line <= ( hits[ i ] + sizeof( T ) - 1 ) / 64; ++line )
+            {
+                if ( result.lines == 0 || line > last_line )
+                {
+                    ++result.lines;
+                    last_line = line;
+                }
+            }
+        }
+
+        result.matches += hits.size();
+    }
+
+    std::size_t matches = 0;
+
+    auto start = chrono::high_resolution_clock::now();
+
+    for ( const rectangle<int> & r : queries )
+    {
+        tree.for_each_match( r, [&matches]( const T & ) { ++matches; } );
+    }
+
+    auto end = chrono::high_resolution_clock::now();
+
+    result.ms = chrono::duration<double, milli>( end - start ).count();
+    assert( matches == result.matches );
+
+    return result;
+}
+
+// the same objects and queries under Morton and Hilbert order
+void compare_curves( const char * workload, const rectangle<int> & world, int levels,
+                     const std::vector< bench_object<int> > & objects, const std::vector< rectangle<int> > & queries )
+{
+    const linear_quadtree< bench_object<int>, morton_curve > morton( world, levels, objects.begin(), objects.end() );
+    const linear_quadtree< bench_object<int>, hilbert_curve > hilbert( world, levels, objects.begin(), objects.end() );
+
+    const match_locality m = measure_locality( morton, queries );
+    const match_locality h = measure_locality( hilbert, queries );
+
+    assert( m.matches == h.matches );
+
+    const double n = double( queries.size() );
+
+    cout << "(curve locality)- " << workload << " : matches/query " << m.matches / n
+         << ", runs/query morton " << m.runs / n << " hilbert " << h.runs / n
+         << ", lines/query morton " << m.lines / n << " hilbert " << h.lines / n
+         << ", ms morton " << m.ms << " hilbert " << h.ms << endl;
+}
+
+// runs and cache lines per query for each curve, on the demo's objects and
+// queries, on the objects of scattered_objects, and on clustered objects
+void bench_curve_locality( int n = 50000, int query_count = 1000 )
+{
+    const rectangle<int> world( 0, 0, 1000, 1000 );
+    std::mt19937 rng( 22 );
+
+    {
+        std::vector< bench_object<int> > objects;
+
+        for ( int i = 0; i < 99; ++i )
+        {
+            objects.push_back( bench_object<int>( i * 10, i * 10, 10, 10, i ));
+        }
+
+        // the bounding-box queries #1 - #7 of test_quad_tree
+        const std::vector< rectangle<int> > queries = {
+            make_bounding_box( point<int>( 0, 0 ), point<int>( 999, 999 )),
+            make_bounding_box( point<int>( 0, 999 ), point<int>( 999, 0 )),
+            make_bounding_box( point<int>( 500, 500 ), point<int>( 999, 999 )),
+            make_bounding_box( point<int>( 0, 0 ), point<int>( 499, 499 )),
+            make_bounding_box( point<int>( 510, 510 ), point<int>( 510, 999 )),
+            make_bounding_box( point<int>( 999, 999 ), point<int>( 600, 600 )),
+            make_bounding_box( point<int>( 500, 500 ), point<int>( 500, 500 )) };
+
+        compare_curves( "demo", world, 5, objects, queries );
+    }
+
+    std::vector< rectangle<int> > queries;
+    std::uniform_int_distribution< int > position( 0, 899 ), extent( 10, 100 );
+
+    for ( int i = 0; i < query_count; ++i )
+    {
+        queries.push_back( rectangle<int>( position( rng ), position( rng ), extent( rng ), extent( rng )));
+    }
+
+    compare_curves( "uniform", world, 10, scattered_objects( n ), queries );
+
+    // objects in a few tight clusters, queried around objects
+    std::vector< bench_object<int> > clustered;
+    std::vector< point<int> > centres;
+    std::uniform_int_distribution< int > size( 1, 8 );
+
+    for ( int i = 0; i < 16; ++i )
+    {
+        centres.push_back( point<int>( 100 + position( rng ) * 8 / 10, 100 + position( rng ) * 8 / 10 ));
+    }
+
+    std::normal_distribution< double > spread( 0.0, 30.0 );
+
+    for ( int i = 0; i < n; ++i )
+    {
+        const point<int> & c = centres[ i % centres.size() ];
+
+        clustered.push_back( bench_object<int>( c.x() + int( spread( rng )), c.y() + int( spread( rng )), size( rng ), size( rng ), i ));
+    }
+
+    queries.clear();
+
+    for ( int i = 0; i < query_count; ++i )
+    {
+        const bench_object<int> & o = clustered[ rng() % clustered.size() ];
+        const int w = extent( rng ) / 2;
+
+        queries.push_back( rectangle<int>( o.x() - w / 2, o.y() - w / 2, w, w ));
+    }
+
+    compare_curves( "clustered", world, 10, clustered, queries );
+}
+
+// orth_tree in 2d against quad_tree, on the same objects and queries: both
+// must build the same nodes and find the same objects
+void bench_orth_tree( int n = 100000, int query_count = 10000 )
+{
+    typedef bench_object<int> object_type;
+    typedef orth_tree< 2, object_type > orth_type;
+    typedef chrono::duration< double, milli > ms;
+
+    const std::vector< object_type > objects = scattered_objects( n );
+    const rectangle<int> world( 0, 0, 1000, 1000 );
+    const orth_type::box_type orth_world = { { 0, 0 }, { 1000, 1000 } };
+
+    std::mt19937 rng( 24 );
+    std::uniform_int_distribution< int > position( 0, 989 ), extent( 1, 40 );
+    std::vector< rectangle<int> > queries;
+
+    for ( int i = 0; i < query_count; ++i )
+    {
+        queries.push_back( rectangle<int>( position( rng ), position( rng ), extent( rng ), extent( rng )));
+    }
+
+    auto t0 = chrono::high_resolution_clock::now();
+    quad_tree< object_type > qtree( world, 10, 10, objects.begin(), objects.end() );
+    auto t1 = chrono::high_resolution_clock::now();
+    orth_type otree( orth_world, 10, 10, objects.begin(), objects.end() );
+    auto t2 = chrono::high_resolution_clock::now();
+
+    assert( qtree.node_count() == otree.node_count() );
+
+    std::size_t found[ 2 ] = { 0, 0 };
+
+    auto t3 = chrono::high_resolution_clock::now();
+    for ( const rectangle<int> & r : queries ) qtree.for_each_match( r, [&]( const object_type & ) { ++found[ 0 ]; } );
+    auto t4 = chrono::high_resolution_clock::now();
+    for ( const rectangle<int> & r : queries ) otree.for_each_match( r, [&]( const object_type & ) { ++found[ 1 ]; } );
+    auto t5 = chrono::high_resolution_clock::now();
+
+    assert( found[ 0 ] == found[ 1 ] );
+
+    // the nearest 8 to the corners of the first tenth of the queries
+    const std::size_t near_count = queries.size() / 10;
+    std::size_t near[ 2 ] = { 0, 0 };
+
+    auto t6 = chrono::high_resolution_clock::now();
+    for ( std::size_t i = 0; i < near_count; ++i ) qtree.nearest( point<int>( queries[ i ].x(), queries[ i ].y() ), 8, [&]( const object_type & ) { ++near[ 0 ]; } );
+    auto t7 = chrono::high_resolution_clock::now();
+    for ( std::size_t i = 0; i < near_count; ++i ) otree.nearest( vector_2d<int>( queries[ i ].x(), queries[ i ].y() ), 8, [&]( const object_type & ) { ++near[ 1 ]; } );
+    auto t8 = chrono::high_resolution_clock::now();
+
+    assert( near[ 0 ] == near[ 1 ] );
+
+    cout << "(orth_tree 2d)- nodes : " << otree.node_count() << ", matches : " << found[ 1 ]
+         << ", ms quad_tree/orth_tree bulk load " << ms( t1 - t0 ).count() << "/" << ms( t2 - t1 ).count()
+         << " box queries " << ms( t4 - t3 ).count() << "/" << ms( t5 - t4 ).count()
+         << " nearest " << ms( t7 - t6 ).count() << "/" << ms( t8 - t7 ).count() << endl;
+}
+
+int main( int argc, char * argv[] )
+{
+    const std::string file = argc > 1 ? argv[ 1 ] : "bench.csv";
+    const std::size_t largest = argc > 2 ? std::strtoull( argv[ 2 ], nullptr, 10 ) : 10000000;
+    const int query_count = argc > 3 ? std::atoi( argv[ 3 ] ) : 1000;
+
+    std::ofstream csv( file.c_str() );
+
+    if ( !csv )
+    {
+        cerr << "cannot write " << file << endl;
+        return 1;
+    }
+
+    bench_concurrent_insert();
+    bench_save_view();
+    bench_curve_locality();
+    bench_orth_tree();
+
+    csv << "dataset,objects,structure,max_levels,max_objects,build_ms,memory_bytes,peak_bytes,nodes,"
+           "query,queries,p50_us,p99_us,mean_us,mean_hits\n";
+
+    for ( std::size_t n = 10000; n <= largest; n *= 10 )
+    {
+        bench_dataset( csv, "uniform", uniform_dataset, n, query_count );
+        bench_dataset( csv, "clustered", clustered_dataset, n, query_count );
+        bench_dataset( csv, "roads", road_dataset, n, query_count );
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef QUADTREE_BULK_LOAD_H
+#define QUADTREE_BULK_LOAD_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * @namespace detail
+ *
+ * The steps of a bulk load, shared by quad_tree and orth_tree. The staged
+ * objects are sorted once by the cell key of their centre (the child index
+ * at each level below a node, most significant first), so the objects of
+ * every node's subtree form one contiguous run, from which the node is
+ * then built in a single pass.
+ */
+namespace detail
+{
+    typedef std::vector< std::uint64_t >                bulk_key_array;
+
+    enum { radix_bits = 11, radix_size = 1 << radix_bits };
+
+    /**
+     * @brief sort_by_key
+     *
+     * Sorts (key, offset) pairs by the low 'bits' bits of the key, with an
+     * LSD radix sort of 11 bits per pass. The keys of a bulk load are short,
+     * so this is usually only two or three passes over the data. Pairs of
+     * equal keys keep their order.
+     */
+    template< typename Keyed_array >
+    void sort_by_key( Keyed_array & keyed, int bits )
+    {
+        typedef typename Keyed_array::value_type keyed_offset;
+
+        if ( keyed.size() < radix_size )
+        {
+            std::sort( keyed.begin(), keyed.end() );
+            return;
+        }
+
+        Keyed_array buffer( keyed.size() );
+
+        std::vector< std::size_t > offsets( radix_size + 1 );
+
+        for ( int shift = 0; shift < bits; shift += radix_bits )
+        {
+            std::fill( offsets.begin(), offsets.end(), 0 );
+
+            for ( const keyed_offset & k : keyed )
+            {
+                ++offsets[ (( k.first >> shift ) & ( radix_size - 1 )) + 1 ];
+            }
+
+            for ( int i = 0; i < radix_size; ++i )
+            {
+                offsets[ i + 1 ] += offsets[ i ];
+            }
+
+            for ( const keyed_offset & k : keyed )
+            {
+                buffer[ offsets[ ( k.first >> shift ) & ( radix_size - 1 ) ]++ ] = k;
+            }
+
+            keyed.swap( buffer );
+        }
+    }
+
+    /**
+     * @brief sort_run
+     *
+     * Keys each object of the run [b, e) with key_of, whose keys use the
+     * low 'bits' bits, and reorders both the keys and the objects of the
+     * run into key order (ties in their current order).
+     */
+    template< typename Container_type, typename Size_type, typename Key_function >
+    void sort_run( Container_type & objects, bulk_key_array & keys, Size_type b, Size_type e, int bits, const Key_function & key_of )
+    {
+        std::vector< std::pair< std::uint64_t, Size_type > > keyed;
+        keyed.reserve( e - b );
+
+        for ( Size_type i = b; i != e; ++i )
+        {
+            keyed.push_back( std::make_pair( key_of( objects[ i ] ), i ));
+        }
+
+        sort_by_key( keyed, bits );
+
+        Container_type sorted;
+        sorted.reserve( e - b );
+
+        for ( Size_type i = 0; i != keyed.size(); ++i )
+        {
+            sorted.push_back( objects[ keyed[ i ].second ] );
+            keys[ b + i ] = keyed[ i ].first;
+        }
+
+        std::copy( sorted.begin(), sorted.end(), objects.begin() + b );
+    }
+
+    /**
+     * @brief hand_down
+     *
+     * Passes the objects of the run [b, e) which stay in a node just split
+     * (those for which stays returns true, having no child to hold them
+     * whole) to keep, and closes up the rest, with their keys, in their
+     * order at the start of the run.
+     *
+     * @return The end of the objects left in the run, for the children.
+     */
+    template< typename Container_type, typename Size_type, typename Stays_function, typename Keep_function >
+    Size_type hand_down( Container_type & objects, bulk_key_array & keys, Size_type b, Size_type e,
+                         const Stays_function & stays, const Keep_function & keep )
+    {
+        Size_type kept = b;
+
+        for ( Size_type i = b; i != e; ++i )
+        {
+            if ( stays( objects[ i ] ))
+            {
+                keep( objects[ i ] );
+            }
+            else
+            {
+                if ( kept != i )
+                {
+                    objects[ kept ] = objects[ i ];
+                    keys[ kept ] = keys[ i ];
+                }
+                ++kept;
+            }
+        }
+
+        return kept;
+    }
+
+    /**
+     * @brief child_run_end
+     *
+     * The end of the run of child 'child' within [b, e), whose keys are in
+     * order and hold the child index in the 'bits' bits at 'shift'.
+     */
+    template< typename Size_type >
+    Size_type child_run_end( const bulk_key_array & keys, Size_type b, Size_type e, int shift, int bits, int child )
+    {
+        const std::uint64_t mask = ( std::uint64_t( 1 ) << bits ) - 1;
+
+        return std::partition_point( keys.begin() + b, keys.begin() + e,
+            [shift, mask, child]( std::uint64_t k ) { return int(( k >> shift ) & mask ) <= child; } ) - keys.begin();
+    }
+}
+
+#endif // QUADTREE_BULK_LOAD_H
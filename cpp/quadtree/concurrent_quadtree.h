@@ -0,0 +1,391 @@
+#ifndef QUADTREE_CONCURRENT_QUADTREE_H
+#define QUADTREE_CONCURRENT_QUADTREE_H
+
+#include "quadtree.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+/**
+ *
+ * concurrent_quad_tree is a quad_tree into which any number of threads may
+ * insert at once. Objects are placed exactly as quad_tree places them, so
+ * once the inserts are done it holds the same objects in the same nodes as
+ * a quad_tree into which the same objects were inserted.
+ *
+ * Each node's bucket has a lock of its own, which is only taken to append
+ * to (or split) that node: inserts into different nodes, such as those
+ * into disjoint quadrants, never wait for each other. The children of a
+ * node are built and filled privately by the thread which splits it, then
+ * published all at once through an atomic pointer, so an insert descends
+ * the tree without locks. Queries lock each node they visit in turn, to
+ * read its objects and its children together.
+ *
+ * Nodes are never merged or freed before the tree is destroyed.
+ *
+ */
+template< typename T >
+class concurrent_quad_tree
+{
+    static const int npos = detail::npos;
+
+    typedef decltype(((T*)nullptr)->x())                point_data_type;
+    typedef detail::bounding_box< detail::has_width_member< T >::value, point_data_type > box_function;
+    typedef detail::object_bucket< T, point_data_type, box_function > bucket_type;
+
+public:
+
+    typedef T                                           value_type;
+    typedef rectangle< point_data_type >                rectangle_type;
+    typedef unsigned                                    size_type;
+
+    concurrent_quad_tree( const rectangle_type & bounds, int max_levels, int max_objects )
+
+        : m_max_levels( max_levels )
+        , m_max_objects( max_objects )
+    {
+        m_root.bounds = bounds;
+    }
+
+    ~concurrent_quad_tree()
+    {
+        destroy( m_root );
+    }
+
+    concurrent_quad_tree( const concurrent_quad_tree & ) = delete;
+    concurrent_quad_tree & operator=( const concurrent_quad_tree & ) = delete;
+
+    const rectangle_type & bounds() const
+    {
+        return m_root.bounds;
+    }
+
+    /**
+     * @brief size
+     * @return the number of objects held; while inserts are running, at
+     * least those whose insert had returned when this was called.
+     */
+    size_type size() const
+    {
+        return size( m_root );
+    }
+
+    /**
+     * @brief node_count
+     * @return the number of nodes, counting the root.
+     */
+    size_type node_count() const
+    {
+        return node_count( m_root );
+    }
+
+    /**
+     *
+     * @brief insert
+     *
+     * Insert an object into the correct node of the quad tree. Safe to call
+     * from any number of threads at once, and alongside the queries below.
+     *
+     */
+    void insert( const value_type & v )
+    {
+        node * h = &m_root;
+
+        for ( ;; )
+        {
+            h = descend( h, v );
+
+            std::lock_guard< std::mutex > lock( h->mutex );
+
+            // h may have been split while waiting for its lock, in which
+            // case v carries on down into the new children
+            node * children = h->children.load( std::memory_order_acquire );
+
+            if ( children && index( *h, v ) != npos ) continue;
+
+            if ( h->objects.capacity() == 0 )
+                h->objects.reserve( m_max_objects + 1 );
+
+            h->objects.push_back( v );
+
+            if ( !children && h->objects.size() > size_type( m_max_objects ) && h->level < size_type( m_max_levels ))
+                split( *h );
+
+            return;
+        }
+    }
+
+    /**
+     * @brief for_each_match
+     *
+     * As quad_tree::for_each_match. Safe to call alongside inserts, in
+     * which case the objects of each node are those it held when visited.
+     * Each node is locked while f is called for its objects, so f must not
+     * insert into this tree.
+     */
+    template< typename Object_type, typename Functor_type >
+    void for_each_match( const Object_type & r, const Functor_type & f ) const
+    {
+        for_each_match( m_root, r, f );
+    }
+
+    /**
+     * @brief for_each_overlap
+     *
+     * As quad_tree::for_each_overlap, under the same conditions as
+     * for_each_match above.
+     */
+    template< typename Object_type, typename Functor_type >
+    void for_each_overlap( const Object_type & r, const Functor_type & f ) const
+    {
+        const typename bucket_type::box_type query = detail::bounding_box< detail::has_width_member< Object_type >::value, point_data_type >()( r );
+
+        for_each_overlap( m_root, r, query, f );
+    }
+
+private:
+
+    /**
+     * A single quad node. Its children, once it has some, are an array of
+     * four allocated together, which is never replaced.
+     */
+    struct node
+    {
+        node()
+
+            : bounds( 0, 0, 0, 0 )
+            , level( 0 )
+            , children( nullptr )
+        {
+        }
+
+        rectangle_type          bounds;
+        size_type               level;
+        std::atomic< node * >   children;
+        mutable std::mutex      mutex;
+        bucket_type             objects;
+    };
+
+    // the deepest node reachable by v's index path without locking
+    node * descend( node * h, const value_type & v ) const
+    {
+        for ( ;; )
+        {
+            node * children = h->children.load( std::memory_order_acquire );
+
+            if ( !children ) return h;
+
+            const int idx = index( *h, v );
+
+            if ( idx == npos ) return h;
+
+            h = children + idx;
+        }
+    }
+
+    /**
+     * Splits h, with its lock held, and pushes its objects down. The
+     * children are filled before they are published, so no other thread
+     * can see them partly filled, nor need to lock them meanwhile.
+     */
+    void split( node & h )
+    {
+        node * children = make_children( h );
+
+        size_type kept = 0;
+
+        for ( size_type i = 0; i < h.objects.size(); ++i )
+        {
+            const int idx = index( h, h.objects[ i ] );
+
+            if ( idx != npos )
+            {
+                insert_private( children[ idx ], h.objects[ i ] );
+            }
+            else
+            {
+                if ( kept != i )
+                    h.objects.set( kept, h.objects[ i ] );
+                ++kept;
+            }
+        }
+
+        h.objects.truncate( kept );
+        h.children.store( children, std::memory_order_release );
+    }
+
+    // as insert, into a node not yet visible to any other thread
+    void insert_private( node & h, const value_type & v )
+    {
+        node * target = &h;
+
+        while ( node * children = target->children.load( std::memory_order_relaxed ))
+        {
+            const int idx = index( *target, v );
+
+            if ( idx == npos ) break;
+
+            target = children + idx;
+        }
+
+        if ( target->objects.capacity() == 0 )
+            target->objects.reserve( m_max_objects + 1 );
+
+        target->objects.push_back( v );
+
+        if ( !target->children.load( std::memory_order_relaxed ) &&
+             target->objects.size() > size_type( m_max_objects ) && target->level < size_type( m_max_levels ))
+            split( *target );
+    }
+
+    // four children, bounded as quad_tree::split bounds them
+    static node * make_children( const node & h )
+    {
+        const rectangle_type & b = h.bounds;
+        const point_data_type half_width = b.width() / 2;
+        const point_data_type half_height = b.height() / 2;
+
+        node * children = new node[ 4 ];
+
+        children[ 0 ].bounds = rectangle_type( b.x(), b.y(), half_width, half_height );
+        children[ 1 ].bounds = rectangle_type( b.x() + half_width, b.y(), half_width, half_height );
+        children[ 2 ].bounds = rectangle_type( b.x() + half_width, b.y() + half_height, half_width, half_height );
+        children[ 3 ].bounds = rectangle_type( b.x(), b.y() + half_height, half_width, half_height );
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            children[ i ].level = h.level + 1;
+        }
+
+        return children;
+    }
+
+    template< typename Obj_type >
+    static int index( const node & n, const Obj_type & obj )
+    {
+        // objects reaching beyond the tree's bounds are held by the root,
+        // as for quad_tree
+        if ( n.level == 0 && !within( n.bounds, obj )) return npos;
+
+        return detail::index< detail::has_width_member< Obj_type >::value, point_data_type >()( n.bounds, obj );
+    }
+
+    template< typename Obj_type >
+    static bool within( const rectangle_type & bounds, const Obj_type & obj )
+    {
+        const detail::box< point_data_type > b = detail::bounding_box< detail::has_width_member< Obj_type >::value, point_data_type >()( obj );
+
+        return b.min_x >= bounds.x() && b.max_x <= bounds.x() + bounds.width() &&
+               b.min_y >= bounds.y() && b.max_y <= bounds.y() + bounds.height();
+    }
+
+    /**
+     * The children of n, read with its lock held, along with its objects
+     * (which visit is called for): a split of n moves objects into the
+     * children as it publishes them, so the objects and children read
+     * together hold every object n's subtree held, whereas children read
+     * before the lock could be null when objects held by n had already
+     * been moved out of it.
+     */
+    template< typename Visit_type >
+    static const node * visit_node( const node & n, const Visit_type & visit )
+    {
+        std::lock_guard< std::mutex > lock( n.mutex );
+
+        visit( n.objects );
+
+        return n.children.load( std::memory_order_acquire );
+    }
+
+    template< typename Object_type, typename Functor_type >
+    void for_each_match( const node & n, const Object_type & r, const Functor_type & f ) const
+    {
+        const node * children = visit_node( n, [&]( const bucket_type & objects )
+        {
+            for ( const T & obj : objects )
+            {
+                f( obj );
+            }
+        });
+
+        if ( children )
+        {
+            int indices = detail::intersects< detail::has_width_member< Object_type >::value, point_data_type >()( n.bounds, r );
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( indices & (1<<i) )
+                {
+                    for_each_match( children[ i ], r, f );
+                }
+            }
+        }
+    }
+
+    template< typename Object_type, typename Functor_type >
+    void for_each_overlap( const node & n, const Object_type & r, const typename bucket_type::box_type & query, const Functor_type & f ) const
+    {
+        const node * children = visit_node( n, [&]( const bucket_type & objects ) { objects.for_each_overlap( query, f ); } );
+
+        if ( children )
+        {
+            int indices = detail::intersects< detail::has_width_member< Object_type >::value, point_data_type >()( n.bounds, r );
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( indices & (1<<i) )
+                {
+                    for_each_overlap( children[ i ], r, query, f );
+                }
+            }
+        }
+    }
+
+    size_type size( const node & n ) const
+    {
+        size_type sz = 0;
+
+        if ( const node * children = visit_node( n, [&]( const bucket_type & objects ) { sz = objects.size(); } ))
+        {
+            for ( int i = 0; i < 4; ++i )
+
+                sz += size( children[ i ] );
+        }
+
+        return sz;
+    }
+
+    size_type node_count( const node & n ) const
+    {
+        size_type count = 1;
+
+        if ( const node * children = n.children.load( std::memory_order_acquire ))
+        {
+            for ( int i = 0; i < 4; ++i )
+
+                count += node_count( children[ i ] );
+        }
+
+        return count;
+    }
+
+    static void destroy( node & n )
+    {
+        if ( node * children = n.children.load() )
+        {
+            for ( int i = 0; i < 4; ++i )
+            {
+                destroy( children[ i ] );
+            }
+
+            delete [] children;
+        }
+    }
+
+    const int   m_max_levels;
+    const int   m_max_objects;
+    node        m_root;
+};
+
+#endif // QUADTREE_CONCURRENT_QUADTREE_H
@@ -16,3 +16,22 @@ bool is_small( double d )
     return std::abs( d ) < std::numeric_limits<double>::epsilon();
 }
 
+bool clip_slab( double p, double q, double & t0, double & t1 )
+{
+    if ( p == 0.0 ) return q >= 0.0;    // parallel: inside the slab or not at all
+
+    double r = q / p;
+
+    if ( p < 0.0 )
+    {
+        if ( r > t1 ) return false;
+        if ( r > t0 ) t0 = r;
+    }
+    else
+    {
+        if ( r < t0 ) return false;
+        if ( r < t1 ) t1 = r;
+    }
+
+    return true;
+}
@@ -2,11 +2,14 @@
 #define QUADTREE_GEOM_H
 
 #include <algorithm>
+#include <array>
 #include <complex>
+#include <cstddef>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <type_traits>
 #include <utility>
-#include <vector>
 
 /**
  * A generalised 2d point class, used by quad_tree.
@@ -84,6 +87,9 @@ private:
 /**
  * A generalised 2d rectangle class, used by quad_tree to facilitate
  * quick look-up of line segments (for intersection testing).
+ *
+ * Only the position and size are stored. The four edges are produced on
+ * demand, by iterating over the rectangle.
  */
 template< typename T >
 class rectangle
@@ -92,7 +98,38 @@ public:
 
     typedef point< T >              point_type;
     typedef line_segment< T >       line_type;
-    typedef const line_type *       const_iterator;
+
+    /**
+     * Iterates over the edges of a rectangle, in the order bottom, right,
+     * top, left (anti-clockwise from x, y), yielding each edge by value.
+     */
+    class const_iterator
+    {
+    public:
+
+        typedef std::input_iterator_tag     iterator_category;
+        typedef line_type                   value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef const line_type *           pointer;
+        typedef line_type                   reference;
+
+        const_iterator( const rectangle * r, int edge )
+
+            : m_rectangle( r )
+            , m_edge( edge )
+        {}
+
+        line_type operator*() const                             { return m_rectangle->edge( m_edge ); }
+        const_iterator & operator++()                           { ++m_edge; return *this; }
+        const_iterator operator++( int )                        { const_iterator t( *this ); ++m_edge; return t; }
+        bool operator==( const const_iterator & other ) const   { return m_edge == other.m_edge; }
+        bool operator!=( const const_iterator & other ) const   { return m_edge != other.m_edge; }
+
+    private:
+
+        const rectangle *   m_rectangle;
+        int                 m_edge;
+    };
 
     // construct from 2 end-points (form a bounding box)
     template< typename U >
@@ -109,22 +146,35 @@ public:
         , m_y( y )
         , m_w( w )
         , m_h( h )
-        , m_edges( {line_type( point_type{ x, y }, point_type{ x + w, y } ),
-                    line_type( point_type{ x + w, y }, point_type{ x + w, y + h } ),
-                    line_type( point_type{ x + w, y + h }, point_type{ x, y + h } ),
-                    line_type( point_type{ x, y + h }, point_type{ x, y } ) } )
     {
 
     }
 
     const_iterator begin() const
     {
-        return m_edges;
+        return const_iterator( this, 0 );
     }
 
     const_iterator end() const
     {
-        return m_edges + 4;
+        return const_iterator( this, 4 );
+    }
+
+    /**
+     * The i'th edge (0 - 3), in the order given by const_iterator.
+     */
+    line_type edge( int i ) const
+    {
+        const T x1 = m_x + m_w;
+        const T y1 = m_y + m_h;
+
+        switch ( i )
+        {
+            case 0:     return line_type( point_type{ m_x, m_y }, point_type{ x1, m_y } );
+            case 1:     return line_type( point_type{ x1, m_y }, point_type{ x1, y1 } );
+            case 2:     return line_type( point_type{ x1, y1 }, point_type{ m_x, y1 } );
+            default:    return line_type( point_type{ m_x, y1 }, point_type{ m_x, m_y } );
+        }
     }
 
     // accessors
@@ -139,8 +189,6 @@ private:
     T               m_y;
     T               m_w;
     T               m_h;
-
-    line_type       m_edges[4];
 };
 
 /**
@@ -168,16 +216,16 @@ rectangle< T > make_bounding_box( const Point_type< T > & p1, const Point_type<
  * the vertices of a rectangle, from a rectangle instance.
  */
 template< template <typename> class Rectangle_type, typename T >
-std::vector< point< T > >
+std::array< point< T >, 4 >
 rectangle_corners( const Rectangle_type<T> & r )
 {
     typedef point< T > point_type;
-    point_type p[ 4 ] = {   point_type( r.x(), r.y() ),
-                            point_type( r.x(), r.y() + r.height() ),
-                            point_type( r.x() + r.width(), r.y() ),
-                            point_type( r.x() + r.width(), r.y() + r.height() ) };
+    std::array< point_type, 4 > p = {{  point_type( r.x(), r.y() ),
+                                        point_type( r.x(), r.y() + r.height() ),
+                                        point_type( r.x() + r.width(), r.y() ),
+                                        point_type( r.x() + r.width(), r.y() + r.height() ) }};
 
-    return std::vector< point_type >( { p[0], p[1], p[2], p[3] } );
+    return p;
 }
 
 /**
@@ -263,5 +311,128 @@ bool has_intersect( const line_segment< T > & l, const line_segment< T > & r )
     return true;
 }
 
+/**
+ * The type in which has_intersect( line_segment, rectangle ) does its
+ * arithmetic: integral coordinates are widened to long long.
+ */
+template< typename T >
+struct intersect_type
+{
+    typedef typename std::conditional< std::is_integral< T >::value, long long, T >::type type;
+};
+
+/**
+ * Determine whether a line segment touches a rectangle (including its
+ * interior), without any division.
+ *
+ * The segment misses the rectangle only if their bounding boxes are
+ * disjoint, or if all four corners of the rectangle lie strictly on the
+ * same side of the line through the segment. The latter is tested at the
+ * centre of the rectangle, against the spread of the corners about it.
+ * Integral coordinates are widened to long long for the products.
+ */
+template< typename T >
+bool has_intersect( const line_segment< T > & l, const rectangle< T > & r )
+{
+    typedef typename intersect_type< T >::type wide_type;
+
+    const wide_type x0 = r.x();
+    const wide_type y0 = r.y();
+    const wide_type x1 = x0 + r.width();
+    const wide_type y1 = y0 + r.height();
+
+    const wide_type px = l.p1().x();
+    const wide_type py = l.p1().y();
+    const wide_type dx = wide_type( l.p2().x() ) - px;
+    const wide_type dy = wide_type( l.p2().y() ) - py;
+
+    // slabs of the rectangle against the segment's bounding box
+    if ( std::max( px, px + dx ) < x0 || std::min( px, px + dx ) > x1 ) return false;
+    if ( std::max( py, py + dy ) < y0 || std::min( py, py + dy ) > y1 ) return false;
+
+    // twice the signed distance (scaled by the segment length) of the
+    // centre from the line, against twice the spread of the corners
+    const wide_type centre = dy * ( x0 + x1 - 2 * px ) - dx * ( y0 + y1 - 2 * py );
+    const wide_type spread = std::abs( dy ) * ( x1 - x0 ) + std::abs( dx ) * ( y1 - y0 );
+
+    return std::abs( centre ) <= spread;
+}
+
+/**
+ * Narrow the parameter range [t0, t1] of a segment to one side of a slab
+ * boundary, where p is the (signed) rate at which the segment approaches
+ * the boundary and q its distance from it at t = 0 (Liang-Barsky).
+ *
+ * @return false if the range becomes empty.
+ */
+bool clip_slab( double p, double q, double & t0, double & t1 );
+
+/**
+ * Find where a line segment enters a rectangle (including its interior).
+ *
+ * @return std::pair<bool, double>, where bool indicates if the segment
+ * touches the rectangle, and double is the parameter t (0 at p1, 1 at p2)
+ * of the first point of the segment within it.
+ */
+template< typename T >
+std::pair< bool, double >
+clip( const line_segment< T > & l, const rectangle< T > & r )
+{
+    const double px = l.p1().x();
+    const double py = l.p1().y();
+    const double dx = double( l.p2().x() ) - px;
+    const double dy = double( l.p2().y() ) - py;
+
+    double t0 = 0.0;
+    double t1 = 1.0;
+
+    bool touches = clip_slab( -dx, px - r.x(), t0, t1 ) &&
+                   clip_slab( dx, double( r.x() ) + r.width() - px, t0, t1 ) &&
+                   clip_slab( -dy, py - r.y(), t0, t1 ) &&
+                   clip_slab( dy, double( r.y() ) + r.height() - py, t0, t1 );
+
+    return std::make_pair( touches, t0 );
+}
+
+/**
+ * The point at parameter t along a line segment (0 at p1, 1 at p2).
+ */
+template< typename T >
+point< T > point_at( const line_segment< T > & l, double t )
+{
+    return point< T >( T( l.p1().x() + t * ( double( l.p2().x() ) - l.p1().x() )),
+                       T( l.p1().y() + t * ( double( l.p2().y() ) - l.p1().y() )));
+}
+
+/**
+ * The parameter t of a point along a line segment (0 at p1, 1 at p2), given
+ * by its projection onto the segment. A zero length segment gives 0.
+ */
+template< typename T >
+double parameter_of( const line_segment< T > & l, const point< T > & p )
+{
+    const double dx = double( l.p2().x() ) - l.p1().x();
+    const double dy = double( l.p2().y() ) - l.p1().y();
+    const double len2 = dx * dx + dy * dy;
+
+    if ( len2 == 0.0 ) return 0.0;
+
+    return ( ( double( p.x() ) - l.p1().x() ) * dx + ( double( p.y() ) - l.p1().y() ) * dy ) / len2;
+}
+
+/**
+ * The squared distance from a point to the nearest point of a rectangle
+ * (including its interior), which is 0 if the point lies within it.
+ */
+template< typename T >
+double squared_distance( const point< T > & p, const rectangle< T > & r )
+{
+    const double x = p.x();
+    const double y = p.y();
+    const double dx = std::max( std::max( double( r.x() ) - x, x - ( double( r.x() ) + r.width() )), 0.0 );
+    const double dy = std::max( std::max( double( r.y() ) - y, y - ( double( r.y() ) + r.height() )), 0.0 );
+
+    return dx * dx + dy * dy;
+}
 
 #endif // GEOM_H
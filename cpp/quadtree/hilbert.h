@@ -0,0 +1,285 @@
+#ifndef QUADTREE_HILBERT_H
+#define QUADTREE_HILBERT_H
+
+#include "morton.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * The state machine of the Hilbert curve, traced from the root down.
+     *
+     * At each level the curve visits the four quadrants of a cell in an
+     * order given by its orientation, one of four: the standard order
+     * (lower left, upper left, upper right, lower right) reflected in the
+     * diagonal, in both axes, both or neither. A state is the orientation
+     * of a cell, as bit 0 set if reflected in the diagonal and bit 1 if in
+     * both axes; the root's is 0.
+     *
+     * The single-level tables map a state and a quadrant (0 - 3: bit 0 the
+     * x bit, bit 1 the y bit) to the quadrant's digit along the curve, and
+     * back, each with the quadrant's own state above the low two bits. The
+     * wide tables do the same four levels at a time: four bits of x (low)
+     * and of y (high) to eight bits of digits, and back, with the state of
+     * the cell four levels down above the low eight bits.
+     */
+    struct hilbert_tables
+    {
+        hilbert_tables()
+        {
+            for ( unsigned state = 0; state < 4; ++state )
+            {
+                for ( unsigned q = 0; q < 4; ++q )
+                {
+                    // the quadrant as seen in the standard orientation
+                    unsigned rx = q & 1, ry = q >> 1;
+
+                    if ( state & 2 ) { rx ^= 1; ry ^= 1; }
+                    if ( state & 1 ) { const unsigned t = rx; rx = ry; ry = t; }
+
+                    const unsigned digit = ( 3 * rx ) ^ ry;
+
+                    // the lower quadrants are reflected in a diagonal, and
+                    // the lower right in both axes too; the upper are not
+                    const unsigned next = state ^ ( ry ? 0 : rx ? 3 : 1 );
+
+                    encode_level[ state ][ q ] = std::uint8_t( digit | next << 2 );
+                    decode_level[ state ][ digit ] = std::uint8_t( q | next << 2 );
+                }
+            }
+
+            // the wide tables pass through every state, so are built once
+            // the single-level tables are complete
+            for ( unsigned state = 0; state < 4; ++state )
+            {
+                for ( unsigned in = 0; in < 256; ++in )
+                {
+                    unsigned s = state, digits = 0, x = 0, y = 0;
+
+                    for ( int i = 3; i >= 0; --i )
+                    {
+                        const unsigned e = encode_level[ s ][ ( in >> i & 1 ) | ( in >> ( i + 4 ) & 1 ) << 1 ];
+
+                        digits = digits << 2 | ( e & 3 );
+                        s = e >> 2;
+                    }
+
+                    encode_nibbles[ state ][ in ] = std::uint16_t( digits | s << 8 );
+
+                    s = state;
+
+                    for ( int i = 3; i >= 0; --i )
+                    {
+                        const unsigned d = decode_level[ s ][ in >> ( 2 * i ) & 3 ];
+
+                        x |= ( d & 1 ) << i;
+                        y |= ( d >> 1 & 1 ) << i;
+                        s = d >> 2;
+                    }
+
+                    decode_digits[ state ][ in ] = std::uint16_t( x | y << 4 | s << 8 );
+                }
+            }
+        }
+
+        std::uint8_t    encode_level[ 4 ][ 4 ];
+        std::uint8_t    decode_level[ 4 ][ 4 ];
+        std::uint16_t   encode_nibbles[ 4 ][ 256 ];
+        std::uint16_t   decode_digits[ 4 ][ 256 ];
+    };
+
+    inline const hilbert_tables & hilbert_table()
+    {
+        static const hilbert_tables tables;
+
+        return tables;
+    }
+
+    /**
+     * @brief hilbert_encode
+     *
+     * The position along the Hilbert curve (2 * level bits) of the cell x, y
+     * of the given level, four levels per table look-up.
+     */
+    inline std::uint64_t hilbert_encode( std::uint32_t x, std::uint32_t y, int level )
+    {
+        const hilbert_tables & t = hilbert_table();
+
+        std::uint64_t z = 0;
+        unsigned state = 0;
+        int l = level;
+
+        for ( ; l >= 4; l -= 4 )
+        {
+            const unsigned e = t.encode_nibbles[ state ][ ( x >> ( l - 4 ) & 15 ) | ( y >> ( l - 4 ) & 15 ) << 4 ];
+
+            z = z << 8 | ( e & 255 );
+            state = e >> 8;
+        }
+
+        for ( ; l > 0; --l )
+        {
+            const unsigned e = t.encode_level[ state ][ ( x >> ( l - 1 ) & 1 ) | ( y >> ( l - 1 ) & 1 ) << 1 ];
+
+            z = z << 2 | ( e & 3 );
+            state = e >> 2;
+        }
+
+        return z;
+    }
+
+    /**
+     * @brief hilbert_decode
+     *
+     * The inverse of hilbert_encode. Returns the state of the cell.
+     */
+    inline unsigned hilbert_decode( std::uint64_t z, int level, std::uint32_t & x, std::uint32_t & y )
+    {
+        const hilbert_tables & t = hilbert_table();
+
+        unsigned state = 0;
+        int l = level;
+
+        x = 0;
+        y = 0;
+
+        for ( ; l >= 4; l -= 4 )
+        {
+            const unsigned d = t.decode_digits[ state ][ z >> ( 2 * ( l - 4 )) & 255 ];
+
+            x = x << 4 | ( d & 15 );
+            y = y << 4 | ( d >> 4 & 15 );
+            state = d >> 8;
+        }
+
+        for ( ; l > 0; --l )
+        {
+            const unsigned d = t.decode_level[ state ][ z >> ( 2 * ( l - 1 )) & 3 ];
+
+            x = x << 1 | ( d & 1 );
+            y = y << 1 | ( d >> 1 & 1 );
+            state = d >> 2;
+        }
+
+        return state;
+    }
+}
+
+/**
+ *
+ * hilbert_curve orders the cells of each level of a linear_quadtree along
+ * the Hilbert curve, a curve policy as morton_curve. Consecutive cells along
+ * it are always adjacent, where Z-order jumps between the quadrants of each
+ * cell, so a region of cells is covered by fewer ranges of codes, and the
+ * objects it holds by fewer runs of the tree's object array.
+ *
+ */
+struct hilbert_curve
+{
+    static std::uint64_t encode( std::uint32_t x, std::uint32_t y, int level )
+    {
+        return detail::hilbert_encode( x, y, level );
+    }
+
+    static void decode( std::uint64_t z, int level, std::uint32_t & x, std::uint32_t & y )
+    {
+        detail::hilbert_decode( z, level, x, y );
+    }
+
+    static std::uint64_t child( std::uint64_t z, int level, int q )
+    {
+        std::uint32_t x, y;
+        const unsigned state = detail::hilbert_decode( z, level, x, y );
+
+        return ( z << 2 ) | ( detail::hilbert_table().encode_level[ state ][ q ] & 3 );
+    }
+
+    static bool step( std::uint64_t z, int level, int axis, int step, std::uint64_t & result )
+    {
+        std::uint32_t c[ 2 ];
+        decode( z, level, c[ 0 ], c[ 1 ] );
+
+        const std::uint32_t last = std::uint32_t(( std::uint64_t( 1 ) << level ) - 1 );
+
+        if ( c[ axis ] == ( step > 0 ? last : 0 )) return false;
+
+        c[ axis ] += step;
+        result = encode( c[ 0 ], c[ 1 ], level );
+        return true;
+    }
+
+    static bool next_in_rect( std::uint64_t z, int level, std::uint32_t x0, std::uint32_t y0,
+                              std::uint32_t x1, std::uint32_t y1, std::uint64_t & result )
+    {
+        const rect r = { x0, y0, x1, y1 };
+
+        return next_in_rect( z, level, r, 0, 0, 0, 0, 0, result );
+    }
+
+    static std::uint64_t cell_key( double dx, double dy, double width, double height, int depth )
+    {
+        return ( std::uint64_t( 1 ) << ( depth * 2 )) |
+               encode( detail::cell_coordinate( dx / width, depth ), detail::cell_coordinate( dy / height, depth ), depth );
+    }
+
+    static void cell_keys( const double * dx, const double * dy, std::size_t n,
+                           double width, double height, int depth, std::uint64_t * keys )
+    {
+        for ( std::size_t i = 0; i < n; ++i )
+        {
+            keys[ i ] = cell_key( dx[ i ], dy[ i ], width, height, depth );
+        }
+    }
+
+private:
+
+    struct rect
+    {
+        std::uint32_t x0, y0, x1, y1;
+    };
+
+    /**
+     * Searches the cell with the given code, level, column and row (the
+     * root, at first) and state for the first cell of the given level in r
+     * whose code is at least z, visiting quadrants in curve order. Any cell
+     * overlapping r has a descendant in r, so once past z the search never
+     * backtracks: it takes at most four steps per level.
+     */
+    static bool next_in_rect( std::uint64_t z, int level, const rect & r, std::uint64_t code, int l,
+                              std::uint32_t x, std::uint32_t y, unsigned state, std::uint64_t & result )
+    {
+        const int below = level - l;
+
+        // the codes and cells of this cell's descendants at the level
+        const std::uint64_t last = (( code + 1 ) << ( 2 * below )) - 1;
+        const std::uint64_t x_min = std::uint64_t( x ) << below, x_max = (( std::uint64_t( x ) + 1 ) << below ) - 1;
+        const std::uint64_t y_min = std::uint64_t( y ) << below, y_max = (( std::uint64_t( y ) + 1 ) << below ) - 1;
+
+        if ( last < z || x_max < r.x0 || x_min > r.x1 || y_max < r.y0 || y_min > r.y1 ) return false;
+
+        if ( below == 0 )
+        {
+            result = code;
+            return true;
+        }
+
+        const detail::hilbert_tables & t = detail::hilbert_table();
+
+        for ( unsigned digit = 0; digit < 4; ++digit )
+        {
+            const unsigned d = t.decode_level[ state ][ digit ];
+
+            if ( next_in_rect( z, level, r, code << 2 | digit, l + 1, x << 1 | ( d & 1 ), y << 1 | ( d >> 1 & 1 ), d >> 2, result ))
+                return true;
+        }
+
+        return false;
+    }
+};
+
+#endif // QUADTREE_HILBERT_H
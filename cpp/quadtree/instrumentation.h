@@ -0,0 +1,331 @@
+#ifndef QUADTREE_INSTRUMENTATION_H
+#define QUADTREE_INSTRUMENTATION_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/**
+ *
+ * no_instrumentation is the default instrumentation policy of quad_tree and
+ * linear_quadtree, under which a tree compiles to the same code as it did
+ * before it had hooks at all (see 'make asm-check').
+ *
+ * An instrumentation policy provides 'enabled', and, as static functions (a
+ * policy holds no state within the tree, as a curve policy holds none):
+ *
+ *  - begin_query and end_query, around each query made through the tree's
+ *    interface; a query run by another (raycast by nearest, say) belongs
+ *    to the outer one;
+ *  - visit_node, for each node a query enters, given the node's level (0
+ *    being the root);
+ *  - edge_test, for each test of a segment against the bounds of a node
+ *    (has_intersect, or clip for raycast);
+ *  - emit, for n objects handed on by a node, to the caller's function or
+ *    to the query's own test of each object.
+ *
+ * Hooks called outside any query (by query_batch's workers, or a packet
+ * traversal, say) count towards nothing.
+ *
+ * The trees only call the hooks of an enabled policy. Even empty, inlined
+ * calls change what the optimiser sees of a traversal (the node's level
+ * is loaded, if to no purpose), and so can change its code; a constant
+ * false condition is folded before any of that.
+ *
+ */
+struct no_instrumentation
+{
+    enum { enabled = false };
+
+    static void begin_query()               {}
+    static void end_query()                 {}
+    static void visit_node( unsigned )      {}
+    static void edge_test()                 {}
+    static void emit( std::size_t = 1 )     {}
+};
+
+/**
+ * A histogram of counts by power of two: bucket 0 holds the zeros, and
+ * bucket b > 0 the values in [2^(b-1), 2^b).
+ */
+class log2_histogram
+{
+public:
+
+    enum { bucket_count = 65 };
+
+    log2_histogram()
+    {
+        counts_.fill( 0 );
+    }
+
+    void add( std::uint64_t v )
+    {
+        ++counts_[ bucket( v ) ];
+    }
+
+    static int bucket( std::uint64_t v )
+    {
+        int b = 0;
+
+        for ( ; v; v >>= 1 )
+            ++b;
+
+        return b;
+    }
+
+    std::uint64_t count( int b ) const
+    {
+        return counts_[ b ];
+    }
+
+    std::uint64_t total() const
+    {
+        std::uint64_t t = 0;
+
+        for ( std::uint64_t c : counts_ )
+            t += c;
+
+        return t;
+    }
+
+    /**
+     * The upper bound (exclusive) of the bucket holding the nth
+     * percentile of the values added, or 0 if none are at all.
+     */
+    std::uint64_t percentile( double nth ) const
+    {
+        const std::uint64_t t = total();
+        std::uint64_t seen = 0;
+
+        for ( int b = 0; b < bucket_count && t; ++b )
+        {
+            seen += counts_[ b ];
+
+            if ( seen * 100.0 >= nth * t )
+                return b == 0 ? 1 : b == 64 ? UINT64_MAX : std::uint64_t( 1 ) << b;
+        }
+
+        return 0;
+    }
+
+    void clear()
+    {
+        counts_.fill( 0 );
+    }
+
+private:
+
+    std::array< std::uint64_t, bucket_count > counts_;
+};
+
+/**
+ * Prints each non-empty bucket as "[low, high): count".
+ */
+inline std::ostream & operator<<( std::ostream & os, const log2_histogram & h )
+{
+    for ( int b = 0; b < log2_histogram::bucket_count; ++b )
+    {
+        if ( !h.count( b )) continue;
+
+        const std::uint64_t low = b == 0 ? 0 : std::uint64_t( 1 ) << ( b - 1 );
+
+        os << "[" << low << ", ";
+
+        if ( b == 64 ) os << "max";
+        else           os << ( std::uint64_t( 1 ) << b );
+
+        os << "): " << h.count( b ) << "\n";
+    }
+
+    return os;
+}
+
+/**
+ *
+ * query_statistics is an instrumentation policy counting, for each query,
+ * the nodes it visited, the edge tests it made, the objects it emitted and
+ * the depth it reached (the deepest level entered), and gathering each into
+ * a histogram across queries.
+ *
+ * The counts are kept per thread, so queries may run on several threads at
+ * once, each seeing its own. They are shared by every tree (of any type)
+ * instrumented with the same policy, so trees to be told apart each take a
+ * policy of their own Tag type.
+ *
+ */
+template< typename Tag = void >
+struct query_statistics
+{
+    enum { enabled = true };
+
+    // the counts of one query
+    struct counts
+    {
+        std::uint64_t   nodes;
+        std::uint64_t   edge_tests;
+        std::uint64_t   emitted;
+        unsigned        depth;
+    };
+
+    struct histograms
+    {
+        std::uint64_t   queries;
+        log2_histogram  nodes;
+        log2_histogram  edge_tests;
+        log2_histogram  emitted;
+        log2_histogram  depth;
+    };
+
+    static void begin_query()
+    {
+        state & s = current();
+
+        if ( s.nesting++ == 0 )
+            s.query = counts();
+    }
+
+    static void end_query()
+    {
+        state & s = current();
+
+        if ( --s.nesting != 0 ) return;
+
+        s.last = s.query;
+
+        ++s.totals.queries;
+        s.totals.nodes.add( s.query.nodes );
+        s.totals.edge_tests.add( s.query.edge_tests );
+        s.totals.emitted.add( s.query.emitted );
+        s.totals.depth.add( s.query.depth );
+    }
+
+    static void visit_node( unsigned level )
+    {
+        state & s = current();
+
+        ++s.query.nodes;
+
+        if ( level > s.query.depth )
+            s.query.depth = level;
+    }
+
+    static void edge_test()
+    {
+        ++current().query.edge_tests;
+    }
+
+    static void emit( std::size_t n = 1 )
+    {
+        current().query.emitted += n;
+    }
+
+    /**
+     * The counts of the last query completed on this thread.
+     */
+    static const counts & last()
+    {
+        return current().last;
+    }
+
+    /**
+     * The histograms of the queries completed on this thread since the
+     * last reset.
+     */
+    static const histograms & totals()
+    {
+        return current().totals;
+    }
+
+    static void reset()
+    {
+        state & s = current();
+
+        s.last = counts();
+        s.totals = histograms();
+    }
+
+private:
+
+    struct state
+    {
+        unsigned        nesting;
+        counts          query;
+        counts          last;
+        histograms      totals;
+    };
+
+    static state & current()
+    {
+        static thread_local state s = state();
+
+        return s;
+    }
+};
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * Brackets a query for the instrumentation policy I, from construction
+     * to destruction. Without instrumentation it is trivially destructible,
+     * so leaves nothing to clean up.
+     */
+    template< typename I, bool = I::enabled >
+    struct query_scope
+    {
+        query_scope()   { I::begin_query(); }
+        ~query_scope()  { I::end_query(); }
+
+        query_scope( const query_scope & ) = delete;
+        query_scope & operator=( const query_scope & ) = delete;
+    };
+
+    template< typename I >
+    struct query_scope< I, false >
+    {
+        query_scope() {}
+    };
+
+    /**
+     * A function of objects reporting each it is passed to I::emit, before
+     * passing it on to f.
+     */
+    template< typename I, typename T, typename Functor_type >
+    struct emitting
+    {
+        emitting( const Functor_type & f )
+
+            : f( f )
+        {}
+
+        void operator()( const T & obj ) const
+        {
+            I::emit();
+            f( obj );
+        }
+
+        const Functor_type & f;
+    };
+
+    /**
+     * The function to which to pass objects emitted one at a time, bound
+     * to f by a const reference: f itself, without instrumentation.
+     */
+    template< typename I, typename T, typename Functor_type, bool = I::enabled >
+    struct emitting_function
+    {
+        typedef emitting< I, T, Functor_type > type;
+    };
+
+    template< typename I, typename T, typename Functor_type >
+    struct emitting_function< I, T, Functor_type, false >
+    {
+        typedef Functor_type type;
+    };
+}
+
+#endif // QUADTREE_INSTRUMENTATION_H
@@ -1,60 +1,62 @@
 #ifndef LINEAR_QUADTREE_H
 #define LINEAR_QUADTREE_H
 
-#include "bin_fraction.h"
 #include "geom.h"
+#include "hilbert.h"
+#include "instrumentation.h"
+#include "morton.h"
+#include "parallel.h"
+#include "small_containers.h"
 
-#include <bitset>
+#include <algorithm>
 #include <cmath>
-#include <set>
-#include <unordered_map>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
-template< class Rectangle_type >
-struct quad_node_comparator
-{
-    typedef std::pair< Rectangle_type, int > quad_node_type;
-    bool operator() ( const quad_node_type & lhs, const quad_node_type & rhs ) const
-    {
-        if ( lhs.first.x() < rhs.first.x() )            return true;
-        if ( lhs.first.x() > rhs.first.x() )            return false;
-        if ( lhs.first.y() < rhs.first.y() )            return true;
-        if ( lhs.first.y() > rhs.first.y() )            return false;
-        if ( lhs.first.width() > rhs.first.width() )    return true;
-        if ( lhs.first.width() < rhs.first.width() )    return false;
-        return lhs.first.height() > rhs.first.height();
-    }
-};
-
-namespace std
-{
-    bool operator< ( const std::bitset<32> & lhs, const std::bitset<32> & rhs )
-    {
-        return lhs.to_ulong() < rhs.to_ulong();
-    }
-}
-
 /**
  *
  * linear_quadtree stores nodes within a flat structure (as opposed to recursive)
- * and performs look-ups through a hashed locator code.
+ * and performs look-ups through a locator code.
  *
- * The look-up index is built during construction based on the dimensions and depth
- * of the octree, and no further resizing is carried out. The aim is to provide
- * fast look-up with static scenery.
+ * Each node is identified by a 64 bit key: a sentinel bit followed by two bits
+ * per level below the root, so up to 31 levels below the root, giving the node's
+ * position along a space-filling curve through the nodes of its level. The curve
+ * is the Curve policy: morton_curve (Z-order, the default) or hilbert_curve.
+ * The key alone gives a node's bounds, parent and children, so no node is stored:
+ * construction takes constant time whatever the depth, and memory is proportional
+ * to the number of objects. The aim is to provide fast look-up with static scenery.
+ *
+ * Objects are held in a single array sorted by the key of their node, so the
+ * objects of a node are adjacent, and are found by binary search. The objects of
+ * nearby nodes of a level are as near in the array as the curve keeps them.
+ *
+ * Queries report what they do to the Instrument policy, as quad_tree's do.
  *
  */
-template< typename T >
+template< typename T, typename Curve = morton_curve, typename Instrument = no_instrumentation >
 class linear_quadtree
 {
+    typedef detail::query_scope< Instrument >           query_scope;
+
+    // a rectangle of cells of one level, by column and row, inclusive
+    struct cell_rectangle
+    {
+        std::uint32_t x0, y0, x1, y1;
+    };
+
 public:
 
     //static const int npos = -1;
     enum { npos = -1 };
 
     typedef T                                           object_type;
-    typedef linear_quadtree< T >                        this_type;
-    typedef const linear_quadtree< T >*                 const_ptr;
+    typedef linear_quadtree< T, Curve, Instrument >     this_type;
+    typedef const linear_quadtree< T, Curve, Instrument >* const_ptr;
+    typedef Curve                                       curve_type;
+    typedef Instrument                                  instrumentation_type;
     typedef decltype(((T*)nullptr)->x())                point_data_type;
 
 public:
@@ -63,61 +65,85 @@ public:
     typedef point< point_data_type >                    point_type;
     typedef line_segment< point_data_type >             line_type;
     typedef rectangle< point_data_type >                rectangle_type;
-    typedef std::pair< rectangle_type, int >            quad_node_type;
-    typedef std::vector< quad_node_type >               quad_node_array;
-    typedef typename quad_node_array::size_type         offset_type;
-    typedef typename quad_node_array::const_iterator    quad_node_iterator;
-    typedef std::bitset<32>                             index_element;
-    //typedef std::unordered_multimap<index_element, T >  container_type;
-    typedef std::unordered_multimap<index_element, T >  container_type;
+    typedef std::uint64_t                               index_element;
+    typedef std::vector< T >                            container_type;
     typedef typename container_type::size_type          size_type;
+    typedef std::pair< size_type, const T * >           batch_match;
+    typedef std::vector< batch_match >                  batch_result_type;
+
+    // the sides of a node, for neighbour()
+    enum direction { west, east, south, north };
+
+    // see quad_tree::raycast_result
+    struct raycast_result
+    {
+        const T *   object;
+        point_type  point;
+        double      t;
+    };
 
-    // @todo : use a hash table? (since look-ups are now exact)...
     typedef std::vector<index_element>                  index_type;
 
     linear_quadtree( const rectangle_type & bounds, int max_levels )
 
-        : max_levels_( max_levels )
+        : bounds_( bounds )
+        , max_levels_( max_levels )
+    {
+    }
+
+    /**
+     * @brief Bulk-load constructor
+     *
+     * Holds the objects in [first, last) as if each had been inserted in
+     * turn, keying each once and then sorting them all together, rather
+     * than inserting each into the sorted array.
+     */
+    template< typename Input_iterator >
+    linear_quadtree( const rectangle_type & bounds, int max_levels, Input_iterator first, Input_iterator last )
+
+        : linear_quadtree( bounds, max_levels )
     {
-        // populate a flat structure of quad bounds
-        bounds_.reserve( upper( max_levels ));
-        index_.reserve( upper( max_levels ));
-        bounds_.push_back( { bounds, npos } );
-        index_.push_back( index_element( 1 ));
+        const container_type staged( first, last );
 
-        for ( int i = 1; i < max_levels; ++i )
-        {
-            int b = upper( i-1 );
-            int e = upper( i );
+        // ties are broken by input position, as insert() keeps them
+        std::vector< std::pair< index_element, size_type > > order;
+        order.reserve( staged.size() );
 
-            for ( int j = b; j < e; ++j )
+        for ( size_type i = 0; i < staged.size(); ++i )
+        {
+            index_element idx;
 
-                populate_children( bounds_[j].first, j, i );
+            if ( node_key( staged[ i ], idx ))
+                order.push_back( { idx, i } );
         }
-    }
 
-    void print_children( const quad_node_iterator & pit ) const
-    {
-        if ( pit == end() ) return;
-        std::cout << "Children of " << (*pit).first << "\n";
-        for ( quad_node_iterator chit = begin_children( pit ); chit != end_children( pit ); ++chit )
+        std::sort( order.begin(), order.end() );
+
+        keys_.reserve( order.size() );
+        objects_.reserve( order.size() );
+
+        for ( const auto & o : order )
         {
-            std::cout << "\t" << (*chit).first << "\n";
+            keys_.push_back( o.first );
+            objects_.push_back( staged[ o.second ] );
         }
-
     }
 
-    void print_bounds( std::ostream & os ) const
+    /**
+     * Prints the key and bounds of each node holding objects.
+     */
+    void print_index( std::ostream & os ) const
     {
-        os << "Generated " << bounds_.size() << " rectangles:" << "\n";
-        for ( const auto & i : bounds_ )
-            os << i.first << ", parent: " << i.second << "\n";
+        for ( size_type i = 0; i < keys_.size(); ++i )
+        {
+            if ( i == 0 || keys_[i] != keys_[i-1] )
+                os << keys_[i] << "\t" << node_bounds( keys_[i] ) << "\n";
+        }
     }
 
-    void print_index( std::ostream & os ) const
+    const rectangle_type & bounds() const
     {
-        for ( size_t i = 0; i < index_.size(); ++i )
-            os << index_[i] << "\t" << bounds_[i].first << "\n";
+        return bounds_;
     }
 
     size_type size() const
@@ -125,371 +151,854 @@ public:
         return objects_.size();
     }
 
-    quad_node_iterator begin() const
+    /**
+     * Computes the locator (the key of the deepest node holding it)
+     * of each of the points in [first, last), writing them to keys, several
+     * points at a time.
+     */
+    void locate( const point_type * first, const point_type * last, index_element * keys ) const
     {
-        return bounds_.begin();
+        enum { chunk = 64 };
+
+        const rectangle_type & b = bounds_;
+        double dx[ chunk ], dy[ chunk ];
+
+        while ( first != last )
+        {
+            const std::size_t n = std::min< std::size_t >( chunk, last - first );
+
+            for ( std::size_t i = 0; i < n; ++i )
+            {
+                dx[ i ] = double( first[ i ].x() - b.x() );
+                dy[ i ] = double( first[ i ].y() - b.y() );
+            }
+
+            Curve::cell_keys( dx, dy, n, double( b.width() ), double( b.height() ), max_levels_ - 1, keys );
+
+            first += n;
+            keys += n;
+        }
     }
 
-    quad_node_iterator end() const
+    void insert( const value_type & obj )
     {
-        return bounds_.end();
+        index_element idx;
+
+        if ( !node_key( obj, idx )) return;
+
+        // after any objects already held by the node
+        const size_type pos = std::upper_bound( keys_.begin(), keys_.end(), idx ) - keys_.begin();
+
+        keys_.insert( keys_.begin() + pos, idx );
+        objects_.insert( objects_.begin() + pos, obj );
     }
 
-    quad_node_iterator begin_children( const quad_node_iterator & parent ) const
+    template< typename Functor_type >
+    void for_each_match( const point_type & p, const Functor_type & f ) const
     {
-        quad_node_iterator b = begin();
-        typename quad_node_iterator::difference_type parent_offset = std::distance( b, parent );
-        typename quad_node_iterator::difference_type child_offset = parent_offset * 4 + 1;
+        const query_scope scope;
 
-        if ( child_offset > bounds_.size() )
-            return end();
+        for ( index_element key = locator( p ); key != npos_key; key = parent( key ))
+        {
+            if ( Instrument::enabled ) Instrument::visit_node( level_of( key ));
 
-        std::advance( b, child_offset );
+            for_each_object( key, f );
+        }
+    }
 
-        return b;
+    template< typename Functor_type >
+    void for_each_match( const rectangle_type & r, const Functor_type & f ) const
+    {
+        const query_scope scope;
+
+        for_each_match( root_key, deepest_cells( r ), f );
     }
 
-    quad_node_iterator end_children( const quad_node_iterator & parent ) const
+    /**
+     * Descends into the children whose cells hold a part of the query, as
+     * the locator places points: the cells of a child at a level are the
+     * deepest cells sharing its column and row bits, so whether it is
+     * reached is found from the same fractions that place the objects.
+     */
+    template< typename Functor_type >
+    void for_each_match( index_element key, const cell_rectangle & cells, const Functor_type & f ) const
     {
-        quad_node_iterator e = begin();
-        typename quad_node_iterator::difference_type parent_offset = std::distance( e, parent );
-        typename quad_node_iterator::difference_type child_offset = parent_offset * 4 + 5;
+        if ( Instrument::enabled ) Instrument::visit_node( level_of( key ));
 
-        if ( child_offset > bounds_.size() )
-            return end();
+        if ( has_children( key ))
+        {
+            const int shift = max_levels_ - 2 - level_of( key );
+
+            for ( int q = 1; q <= 4; ++q )
+            {
+                const index_element child = child_key( key, q );
+                std::uint32_t cx, cy;
 
-        std::advance( e, parent_offset * 4 + 5 );
+                cell_coordinates( child, cx, cy );
 
-        return e;
+                if ( cx >= cells.x0 >> shift && cx <= cells.x1 >> shift &&
+                     cy >= cells.y0 >> shift && cy <= cells.y1 >> shift && !subtree_empty( child ))
+                    for_each_match( child, cells, f );
+            }
+        }
+
+        for_each_object( key, f );
     }
 
-    void insert( const value_type & obj )
+    /**
+     * As for_each_match, finding the same objects, but through a scan of the
+     * sorted keys at each level. The nodes overlapping r at a level form
+     * a rectangle of cells; keys outside it are skipped by jumping to the
+     * next key within it (BIGMIN, with morton_curve), so each level takes a
+     * handful of contiguous scans rather than a recursive descent, which
+     * searches the keys for objects below each child it might enter.
+     */
+    template< typename Functor_type >
+    void for_each_match_ranges( const rectangle_type & r, const Functor_type & f ) const
     {
-        // find the indices of the four corners
-        std::set<offset_type> ind = indices( obj );
+        const query_scope scope;
+        const int depth = max_levels_ - 1;
+        const cell_rectangle cells = deepest_cells( r );
 
-        // if the corners are in different nodes, then move up the levels
-        // until the smallest single containing node is found
-        while ( ind.size() > 1 )
+        for ( int level = 0; level <= depth; ++level )
         {
-            ind = parent_indices( ind );
+            const int shift = depth - level;
+
+            scan_cells( level, cells.x0 >> shift, cells.y0 >> shift, cells.x1 >> shift, cells.y1 >> shift, f );
         }
+    }
 
-        if ( ind.empty() ) return;
-        offset_type off = *ind.begin();
-        index_element idx( index_[off] );
-        //std::cout << "Object " << obj << " is in quad " << bounds_[off].first << std::endl;
-        objects_.insert( { idx, obj } );
+    /**
+     * The key of the node at the given level (0 being the root) holding p.
+     */
+    index_element cell( const point_type & p, int level ) const
+    {
+        return locator( p ) >> ( 2 * ( max_levels_ - 1 - level ));
+    }
+
+    rectangle_type cell_bounds( index_element key ) const
+    {
+        return node_bounds( key );
     }
 
+    /**
+     * The key of the node of the same level adjacent to the given node on
+     * the given side, or 0 if that side is the edge of the tree. Found with
+     * no search: with morton_curve, by adding to (or subtracting from) one
+     * coordinate of the dilated integer key.
+     */
+    static index_element neighbour( index_element key, direction d )
+    {
+        const int level = level_of( key );
+        const index_element sentinel = index_element( 1 ) << ( 2 * level );
+
+        index_element z;
+
+        if ( !Curve::step( key ^ sentinel, level, d == west || d == east ? 0 : 1, d == east || d == north ? 1 : -1, z ))
+            return npos_key;
+
+        return sentinel | z;
+    }
+
+    /**
+     * Calls f( key ) for the key of every node holding objects with
+     * key_lo <= key <= key_hi, in ascending order.
+     */
     template< typename Functor_type >
-    void for_each_match( const point_type & p, const Functor_type & f ) const
+    void cells_in_range( index_element key_lo, index_element key_hi, const Functor_type & f ) const
     {
-        offset_type off = index( p );
+        typename index_type::const_iterator it = std::lower_bound( keys_.begin(), keys_.end(), key_lo );
 
-        while ( off != npos )
+        while ( it != keys_.end() && *it <= key_hi )
         {
-            index_element idx( index_[off] );
-            auto range = objects_.equal_range( idx );
+            const index_element key = *it;
 
-            for ( auto it = range.first; it != range.second; ++it )
-            {
-                f( (*it).second );
-            }
+            f( key );
 
-            // @todo: should be possible to get parent via arithmetic?
-            off = bounds_[off].second;
+            it = std::upper_bound( it, keys_.end(), key );
         }
     }
 
+    /**
+     * Calls f for each object held by the node with the given key.
+     */
     template< typename Functor_type >
-    void for_each_match( const rectangle_type & r, const Functor_type & f ) const
+    void for_each_in_cell( index_element key, const Functor_type & f ) const
+    {
+        for_each_object( key, f );
+    }
+
+    /**
+     * Calls f for every object whose bounding box lies within distance r of
+     * p, entering only the nodes which lie within r of p themselves (see
+     * quad_tree::within_radius). Objects reaching beyond the tree's bounds
+     * are held by the root (see node_key).
+     */
+    template< typename Functor_type >
+    void within_radius( const point_type & p, point_data_type r, const Functor_type & f ) const
+    {
+        const query_scope scope;
+
+        within_radius( root_key, p, double( r ) * r, f );
+    }
+
+    template< typename Functor_type >
+    void line_intersect( const line_type & l, const Functor_type & f ) const
+    {
+        const query_scope scope;
+
+        line_intersect( root_key, l, f );
+    }
+
+    template< typename Functor_type >
+    void first_line_intersect( const line_type & l, const Functor_type & f ) const
+    {
+        const query_scope scope;
+
+        first_line_intersect( root_key, l, f );
+    }
+
+    /**
+     * Finds the object hit nearest to p1 along the segment l, searching
+     * nodes best-first by the parameter at which the segment enters them
+     * (see quad_tree::raycast).
+     */
+    template< typename Hit_test >
+    raycast_result raycast( const line_type & l, const Hit_test & hit_test ) const
     {
-        for_each_match( begin(), r, f );
+        const query_scope scope;
+
+        return best_first_raycast( l, custom_hit< Hit_test >{ hit_test } );
     }
 
-    int quadrant( const rectangle_type & bounds, const point_type & p ) const
+    /**
+     * As above, where an object is hit where the segment enters its
+     * bounding box (or at p1, if it starts inside it).
+     */
+    raycast_result raycast( const line_type & l ) const
     {
-        int x_midpoint = bounds.x() + bounds.width() / 2;
-        int y_midpoint = bounds.y() + bounds.height() / 2;
+        const query_scope scope;
 
-        bool bottom_half = p.y() < y_midpoint;
-        bool top_half = p.y() >= y_midpoint;
+        return best_first_raycast( l, box_hit() );
+    }
 
-        int result = npos;
+    /**
+     * Runs for_each_match for every query in [first, last), sharing the
+     * queries between worker threads, each of which appends (query index,
+     * object) pairs to a buffer of its own (see quad_tree::query_batch).
+     * With morton_order set, the queries are run in order of the locator of
+     * their centre.
+     */
+    template< typename Query_iterator >
+    void query_batch( Query_iterator first, Query_iterator last, std::vector< batch_result_type > & results,
+                      unsigned threads = detail::default_thread_count(), bool morton_order = false ) const
+    {
+        const size_type count = std::distance( first, last );
+
+        std::vector< std::pair< index_element, size_type > > order;
+        order.reserve( count );
 
-        // left half is between x and x_midpoint
-        if ( p.x() < x_midpoint )
+        std::vector< point_type > centres;
+        std::vector< index_element > keys( morton_order ? count : 0 );
+
+        if ( morton_order )
         {
-            if ( top_half )
-                result = 3;
-            else if ( bottom_half )
-                result = 1;
+            centres.reserve( count );
+
+            for ( size_type i = 0; i < count; ++i )
+            {
+                centres.push_back( centre( first[ i ] ));
+            }
+
+            locate( centres.data(), centres.data() + count, keys.data() );
         }
-        // right half is between x_midpoint and x + width
-        else if ( p.x() >= x_midpoint )
+
+        for ( size_type i = 0; i < count; ++i )
         {
-            if ( top_half )
-                result = 4;
-            else if ( bottom_half )
-                result = 2;
+            order.push_back( { morton_order ? keys[ i ] : 0, i } );
         }
-        return result;
+
+        if ( morton_order )
+            std::sort( order.begin(), order.end() );
+
+        detail::run_batch( count, threads, 32, results,
+            [&]( std::size_t i, batch_result_type & matches )
+            {
+                const size_type q = order[ i ].second;
+
+                for_each_match( first[ q ], [&matches, q]( const T & obj ) { matches.push_back( batch_match( q, &obj )); } );
+            });
     }
 
-    std::set<int> quadrants( const rectangle_type & bounds, const rectangle_type & r ) const
+    /**
+     * As above, but passes each worker's buffer to the supplied sink (on the
+     * calling thread) once all of the queries have run.
+     */
+    template< typename Query_iterator, typename Sink_type >
+    void query_batch( Query_iterator first, Query_iterator last, const Sink_type & sink,
+                      unsigned threads = detail::default_thread_count(), bool morton_order = false ) const
     {
-        std::set<int> result;
+        std::vector< batch_result_type > results;
 
-        for ( const auto & corner : rectangle_corners( r ) )
+        query_batch( first, last, results, threads, morton_order );
+
+        for ( const batch_result_type & matches : results )
         {
-            result.insert( quadrant( bounds, corner ));
+            sink( matches );
         }
+    }
 
-        return result;
+private:
+
+    static point_type centre( const point_type & p )
+    {
+        return p;
     }
 
-    template< typename Functor_type >
-    void for_each_match( const quad_node_iterator & it, const rectangle_type & r, const Functor_type & f ) const
+    static point_type centre( const rectangle_type & r )
     {
-        //std::cout << "for_each_child_match " << (*it).first << "\n";
+        return point_type( r.x() + r.width() / 2, r.y() + r.height() / 2 );
+    }
 
-        for ( const auto & q : quadrants( (*it).first, r ) )
+    template< typename Hit_test >
+    struct custom_hit
+    {
+        bool operator()( const T & obj, const line_type & l, point_type & p, double & t ) const
         {
-            if ( q != npos )
+            std::pair< bool, point_type > hit = hit_test( obj, l );
+
+            if ( !hit.first ) return false;
+
+            p = hit.second;
+            t = parameter_of( l, p );
+            return true;
+        }
+
+        const Hit_test & hit_test;
+    };
+
+    struct box_hit
+    {
+        bool operator()( const T & obj, const line_type & l, point_type & p, double & t ) const
+        {
+            std::pair< bool, double > entry = clip( l, rectangle_type( obj.x(), obj.y(), obj.width(), obj.height() ));
+
+            if ( !entry.first ) return false;
+
+            t = entry.second;
+            p = point_at( l, t );
+            return true;
+        }
+    };
+
+    // an edge of node_bounds, rounded outward to the coordinate type
+    static point_data_type lower_edge( double e )
+    {
+        return edge( e, false, std::is_integral< point_data_type >() );
+    }
+
+    static point_data_type upper_edge( double e )
+    {
+        return edge( e, true, std::is_integral< point_data_type >() );
+    }
+
+    static point_data_type edge( double e, bool upper, std::true_type /*integral*/ )
+    {
+        return point_data_type( upper ? std::ceil( e ) : std::floor( e ));
+    }
+
+    static point_data_type edge( double e, bool upper, std::false_type /*integral*/ )
+    {
+        return std::nextafter( point_data_type( e ), upper ? std::numeric_limits< point_data_type >::max()
+                                                           : std::numeric_limits< point_data_type >::lowest() );
+    }
+
+    template< typename Hit_type >
+    raycast_result best_first_raycast( const line_type & l, const Hit_type & hit ) const
+    {
+        typedef std::pair< double, index_element > entry_type;
+
+        detail::small_priority_queue< entry_type, 64, std::greater< entry_type > > open;
+        raycast_result best = { nullptr, l.p2(), std::numeric_limits< double >::max() };
+
+        // objects reaching beyond the tree's bounds are held by the root
+        // (see node_key), so it is searched whether or not the segment enters it
+        open.push( entry_type( 0.0, root_key ));
+
+        while ( !open.empty() && open.top().first < best.t )
+        {
+            const index_element key = open.top().second;
+            open.pop();
+
+            point_type p = point_type::zero();
+            double t = 0.0;
+            const object_range range = objects_in( key );
+
+            if ( Instrument::enabled )
             {
-                quad_node_iterator b = begin();
-                typename quad_node_iterator::difference_type this_offset = std::distance( b, it );
-                typename quad_node_iterator::difference_type child_offset = this_offset * 4 + q;
+                Instrument::visit_node( level_of( key ));
+                Instrument::emit( range.second - range.first );
+            }
+
+            for ( size_type i = range.first; i != range.second; ++i )
+            {
+                if ( hit( objects_[ i ], l, p, t ) && t < best.t )
+                {
+                    best.object = &objects_[ i ];
+                    best.point = p;
+                    best.t = t;
+                }
+            }
 
-                if ( child_offset < bounds_.size() )
+            if ( has_children( key ))
+            {
+                // the four children, whatever the curve, in its order
+                for ( index_element child = key << 2; child != ( key + 1 ) << 2; ++child )
                 {
-                    size_t num_objs = objects_.count( index_[child_offset] );
+                    if ( subtree_empty( child )) continue;
+
+                    if ( Instrument::enabled ) Instrument::edge_test();
 
-                    if ( num_objs > 0 )
-                    {
-                        std::advance( b, child_offset );
-                        for_each_match( b, r, f );
-                    }
+                    std::pair< bool, double > entry = clip( l, node_bounds( child ));
+
+                    if ( entry.first && entry.second < best.t )
+                        open.push( entry_type( entry.second, child ));
                 }
             }
         }
 
-        offset_type off = std::distance( begin(), it );
-        index_element idx( index_[off] );
-        auto range = objects_.equal_range( idx );
+        return best;
+    }
+
+    template< typename Functor_type >
+    void within_radius( index_element key, const point_type & p, double r2, const Functor_type & f ) const
+    {
+        if ( Instrument::enabled ) Instrument::visit_node( level_of( key ));
+
+        if ( has_children( key ))
+        {
+            // the four children, whatever the curve, in its order
+            for ( index_element child = key << 2; child != ( key + 1 ) << 2; ++child )
+            {
+                if ( squared_distance( p, node_bounds( child )) <= r2 && !subtree_empty( child ))
+                    within_radius( child, p, r2, f );
+            }
+        }
+
+        const object_range range = objects_in( key );
 
-        for ( auto it = range.first; it != range.second; ++it )
+        for ( size_type i = range.first; i != range.second; ++i )
         {
-            f( (*it).second );
+            const T & obj = objects_[ i ];
+
+            if ( squared_distance( p, rectangle_type( obj.x(), obj.y(), obj.width(), obj.height() )) <= r2 )
+            {
+                if ( Instrument::enabled ) Instrument::emit();
+
+                f( obj );
+            }
         }
     }
 
-    template< typename Functor_type >
-    void line_intersect( const line_type & l, const Functor_type & f ) const
+    /**
+     * The order in which to visit the children of a node (1 lower left,
+     * 2 lower right, 3 upper left, 4 upper right), nearest first, for a
+     * segment running from p1 towards p2.
+     */
+    static const int * front_to_back( const line_type & l )
     {
-        quad_node_iterator it = begin();
-        line_intersect( it, l, f );
+        static const int order[ 4 ][ 4 ] = { { 1, 2, 3, 4 },      // +x, +y
+                                              { 2, 1, 4, 3 },      // -x, +y
+                                              { 3, 1, 4, 2 },      // +x, -y
+                                              { 4, 2, 3, 1 } };    // -x, -y
+
+        return order[ ( l.p2().x() < l.p1().x() ) | ( l.p2().y() < l.p1().y() ) << 1 ];
     }
 
-    template< typename Functor_type >
-    void first_line_intersect( const line_type & l, const Functor_type & f ) const
+    /**
+     * The key of the node to hold obj: the smallest node holding all four of
+     * its corners, or the root if it reaches beyond the tree's bounds.
+     */
+    bool node_key( const value_type & obj, index_element & key ) const
     {
-        quad_node_iterator it = begin();
-        first_line_intersect( it, l, f );
+        // the locator wraps positions outside the tree back into it, so an
+        // object reaching beyond the bounds (or onto their right or top edge,
+        // which the locator wraps to the left or bottom) would be held by a
+        // node far from it, and missed by every query pruning by the nodes'
+        // bounds
+        if ( !within_bounds( obj ))
+        {
+            key = root_key;
+            return true;
+        }
+
+        // find the keys of the four corners
+        key_set ind = indices( obj );
+
+        // if the corners are in different nodes, then move up the levels
+        // until the smallest single containing node is found
+        while ( ind.size() > 1 )
+        {
+            ind = parent_indices( ind );
+        }
+
+        if ( ind.empty() ) return false;
+
+        key = *ind.begin();
+        return true;
     }
 
-private:
+    bool within_bounds( const value_type & obj ) const
+    {
+        const rectangle_type & b = bounds_;
+
+        return obj.x() >= b.x() && obj.x() + obj.width() < b.x() + b.width() &&
+               obj.y() >= b.y() && obj.y() + obj.height() < b.y() + b.height();
+    }
 
-    bool in_bounds( const rectangle_type & r, const point_type & p ) const
+    // the positions [first, second) in objects_ of the objects of a node
+    typedef std::pair< size_type, size_type >           object_range;
+
+    object_range objects_in( index_element key ) const
     {
-        bool in_x_bounds = p.x() >= r.x() && p.x() <= r.x() + r.width();
-        bool in_y_bounds = p.y() >= r.y() && p.y() <= r.y() + r.height();
+        const typename index_type::const_iterator b = std::lower_bound( keys_.begin(), keys_.end(), key );
+        const typename index_type::const_iterator e = std::lower_bound( b, keys_.end(), key + 1 );
 
-        return in_x_bounds && in_y_bounds;
+        return object_range( b - keys_.begin(), e - keys_.begin() );
     }
 
-    offset_type index( const point_type & p ) const
+    /**
+     * Whether no node in the subtree of key holds objects. Its descendants
+     * at each level have the keys of a range, and the levels follow one
+     * another in the sorted keys, so each takes one search, from where the
+     * level above left off.
+     */
+    bool subtree_empty( index_element key ) const
     {
-        // Locate the offset of a point within the index.
+        typename index_type::const_iterator it = keys_.begin();
 
-        std::bitset<32> loc = locator( p );
-        //std::cout << loc << std::endl;
+        for ( index_element first = key, last = key + 1; ; first <<= 2, last <<= 2 )
+        {
+            it = std::lower_bound( it, keys_.end(), first );
 
-        index_type::const_iterator pos = std::lower_bound( index_.begin(), index_.end(), loc );
+            if ( it == keys_.end() ) return true;
+            if ( *it < last ) return false;
+            if ( !has_children( first )) return true;
+        }
+    }
 
-        if ( pos == index_.end() )
+    template< typename Functor_type >
+    void for_each_object( index_element key, const Functor_type & f ) const
+    {
+        const object_range range = objects_in( key );
+
+        if ( Instrument::enabled ) Instrument::emit( range.second - range.first );
+
+        for ( size_type i = range.first; i != range.second; ++i )
         {
-            return npos;
+            f( objects_[ i ] );
         }
-        else
+    }
+
+    /**
+     * The distinct node keys of the corners of a rectangle, of which there
+     * are at most four, held inline.
+     */
+    class key_set
+    {
+    public:
+
+        key_set()
+
+            : count_( 0 )
+        {}
+
+        void insert( index_element key )
         {
-            return std::distance( index_.begin(), pos );
+            if ( std::find( begin(), end(), key ) == end() )
+                values_[ count_++ ] = key;
         }
 
-    }
+        const index_element * begin() const { return values_; }
+        const index_element * end() const   { return values_ + count_; }
+        std::size_t size() const            { return count_; }
+        bool empty() const                  { return count_ == 0; }
+
+    private:
+
+        index_element   values_[ 4 ];
+        std::size_t     count_;
+    };
 
     template< template <typename> class Rectangle_type, typename U >
-    std::set<offset_type> indices( const Rectangle_type<U> & r ) const
+    key_set indices( const Rectangle_type<U> & r ) const
     {
-        std::vector< point_type > corners = rectangle_corners( r );
+        const auto corners = rectangle_corners( r );
 
-        std::set< offset_type > result;
+        index_element keys[ 4 ];
+        locate( corners.data(), corners.data() + 4, keys );
 
-        for ( const auto & p : corners )
-        {
-            int idx = index( p );
+        key_set result;
 
-            if ( idx != npos ) result.insert( idx );
+        for ( index_element key : keys )
+        {
+            result.insert( key );
         }
 
         return result;
 
     }
 
-    std::set<offset_type> parent_indices( const std::set<offset_type> & ind ) const
+    key_set parent_indices( const key_set & ind ) const
     {
-        std::set<offset_type> result;
+        key_set result;
 
         for ( auto i : ind )
         {
-            offset_type parent = bounds_[i].second;
+            index_element p = parent( i );
 
-            if ( parent != npos )
-                result.insert( parent );
+            if ( p != npos_key )
+                result.insert( p );
         }
 
         if ( result.empty() )
         {
-            result.insert( 0 ); // default
+            result.insert( root_key ); // default
         }
 
         return result;
     }
 
     template< typename Functor_type >
-    void line_intersect( const quad_node_iterator & it, const line_type & l, const Functor_type & f ) const
+    void line_intersect( index_element key, const line_type & l, const Functor_type & f ) const
     {
-        int intersect_count = 0;
-        for ( const auto & edge : (*it).first )
-        {
-            intersect_count += intersect( l, edge ).first;
-        }
+        if ( Instrument::enabled ) Instrument::edge_test();
 
-        bool p1_in_bounds = in_bounds( (*it).first, l.p1() );
-        bool p2_in_bounds = in_bounds( (*it).first, l.p2() );
-
-        if ( intersect_count > 0 || p1_in_bounds || p2_in_bounds )
+        if ( has_intersect( l, node_bounds( key )))
         {
-            for ( quad_node_iterator ch_it = begin_children( it ); ch_it != end_children( it ); ++ch_it )
+            if ( Instrument::enabled ) Instrument::visit_node( level_of( key ));
+
+            // children are visited nearest first along the segment
+            if ( has_children( key ))
             {
-                line_intersect( ch_it, l, f );
-            }
+                const int * order = front_to_back( l );
 
-            auto off = std::distance( begin(), it );
-            index_element idx( index_[off] );
-            auto range = objects_.equal_range( idx );
+                for ( int i = 0; i < 4; ++i )
+                {
+                    const index_element child = child_key( key, order[ i ] );
 
-            for ( auto obj_it = range.first; obj_it != range.second; ++obj_it )
-            {
-                f( (*obj_it).second );
+                    if ( !subtree_empty( child ))
+                        line_intersect( child, l, f );
+                }
             }
+
+            for_each_object( key, f );
         }
     }
 
     template< typename Functor_type >
-    void first_line_intersect( const quad_node_iterator & it, const line_type & l, const Functor_type & f ) const
+    void first_line_intersect( index_element key, const line_type & l, const Functor_type & f ) const
     {
         if ( !f.active() ) return;
 
-        int intersect_count = 0;
-        for ( const auto & edge : (*it).first )
+        if ( Instrument::enabled ) Instrument::edge_test();
+
+        if ( has_intersect( l, node_bounds( key )))
         {
-            intersect_count += intersect( l, edge ).first;
+            if ( Instrument::enabled ) Instrument::visit_node( level_of( key ));
+
+            // children are visited nearest first along the segment
+            if ( has_children( key ))
+            {
+                const int * order = front_to_back( l );
+
+                for ( int i = 0; i < 4; ++i )
+                {
+                    const index_element child = child_key( key, order[ i ] );
+
+                    if ( !subtree_empty( child ))
+                        first_line_intersect( child, l, f );
+                }
+            }
+
+            for_each_object( key, f );
         }
+    }
+
+    index_element locator( const point_type & p ) const
+    {
+        // Builds a binary locator based on the curve ordering of the point coordinates.
+        // Locator is used to identify the position of the point within the index.
+        // The locator is that of the deepest level (max_levels_ - 1), since
+        // we're locating a single point.
 
-        bool p1_in_bounds = in_bounds( (*it).first, l.p1() );
-        bool p2_in_bounds = in_bounds( (*it).first, l.p2() );
+        const rectangle_type & b = bounds_;
 
-        if ( intersect_count > 0 || p1_in_bounds || p2_in_bounds )
+        return Curve::cell_key( double( p.x() - b.x() ), double( p.y() - b.y() ),
+                                 double( b.width() ), double( b.height() ), max_levels_ - 1 );
+    }
+
+    /**
+     * The column (or row) of the deepest cells holding the offset d from
+     * the origin of a tree of the given extent, clamped to the tree rather
+     * than wrapped as the locator wraps it.
+     */
+    std::uint32_t clamped_coordinate( point_data_type d, point_data_type extent ) const
+    {
+        const int depth = max_levels_ - 1;
+        const double f = double( d ) / double( extent );
+
+        if ( f <= 0.0 ) return 0;
+        if ( f >= 1.0 ) return std::uint32_t(( index_element( 1 ) << depth ) - 1 );
+
+        return detail::cell_coordinate( f, depth );
+    }
+
+    /**
+     * The rectangle of deepest cells [x0, x1] x [y0, y1] holding the corners
+     * of r, clamped to the tree.
+     */
+    cell_rectangle deepest_cells( const rectangle_type & r ) const
+    {
+        const cell_rectangle cells =
         {
-            for ( quad_node_iterator ch_it = begin_children( it ); ch_it != end_children( it ); ++ch_it )
+            clamped_coordinate( r.x() - bounds_.x(), bounds_.width() ),
+            clamped_coordinate( r.y() - bounds_.y(), bounds_.height() ),
+            clamped_coordinate( r.x() + r.width() - bounds_.x(), bounds_.width() ),
+            clamped_coordinate( r.y() + r.height() - bounds_.y(), bounds_.height() )
+        };
+
+        return cells;
+    }
+
+    /**
+     * Calls f for the objects of every node at the given level within the
+     * rectangle of cells [x0, x1] x [y0, y1].
+     */
+    template< typename Functor_type >
+    void scan_cells( int level, std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1, const Functor_type & f ) const
+    {
+        const index_element sentinel = index_element( 1 ) << ( 2 * level );
+
+        index_element z;
+
+        if ( !Curve::next_in_rect( 0, level, x0, y0, x1, y1, z )) return;
+
+        typename index_type::const_iterator it = std::lower_bound( keys_.begin(), keys_.end(), sentinel | z );
+        const typename index_type::const_iterator last = std::lower_bound( it, keys_.end(), sentinel << 2 );
+
+        while ( it != last )
+        {
+            const index_element key = *it;
+            std::uint32_t x, y;
+
+            z = key ^ sentinel;
+            Curve::decode( z, level, x, y );
+
+            if ( x >= x0 && x <= x1 && y >= y0 && y <= y1 )
             {
-                first_line_intersect( ch_it, l, f );
-            }
+                if ( Instrument::enabled ) Instrument::visit_node( level );
 
-            auto off = std::distance( begin(), it );
-            index_element idx( index_[off] );
-            auto range = objects_.equal_range( idx );
+                for ( ; it != last && *it == key; ++it )
+                {
+                    if ( Instrument::enabled ) Instrument::emit();
 
-            for ( auto obj_it = range.first; obj_it != range.second; ++obj_it )
+                    f( objects_[ it - keys_.begin() ] );
+                }
+            }
+            else
             {
-                f( (*obj_it).second );
+                if ( !Curve::next_in_rect( z, level, x0, y0, x1, y1, z )) return;
+
+                it = std::lower_bound( it, last, sentinel | z );
             }
         }
     }
 
-    std::bitset<32> locator( const point_type & p ) const
+    // node geometry, from the key alone
+
+    // the key of the root, and the parent of the root
+    enum : index_element { root_key = 1, npos_key = 0 };
+
+    static index_element parent( index_element key )
     {
-        // Builds a binary locator based on Morton ordering of the point coordinates.
-        // Locator is used to identify the position of the point within the index.
+        return key >> 2;
+    }
 
-        //std::cout << "locate point " << p << "\n";
-        // calculate the location code for a given point (a binary fraction assuming Morton order)
-        double dx = double( p.x() - bounds_[0].first.x() ) / double( bounds_[0].first.width() );
-        double dy = double( p.y() - bounds_[0].first.y() ) / double( bounds_[0].first.height() );
-
-        std::bitset<32> bitsx = bin_fraction(dx, max_levels_);
-        //std::cout << "bitsx " << bitsx << "\n";
-        std::bitset<32> bitsy = bin_fraction(dy, max_levels_);
-        //std::cout << "bitsy " << bitsy << "\n";
-        std::bitset<32> result;
-        for ( int i = 31; i >= 0; --i )
-        {
-            result[(i*2)+1] = bitsy[i];
-            result[i*2] = bitsx[i];
-        }
-        result[max_levels_+3] = 1;  // sentinel bit set to assume lowest-level
-                                    // (since we're locating a single point)
+    // the key of child q of a node (1 lower left, 2 lower right, 3 upper left,
+    // 4 upper right)
+    static index_element child_key( index_element key, int q )
+    {
+        const int level = level_of( key );
+        const index_element sentinel = index_element( 1 ) << ( 2 * level );
 
-        return result;
+        return ( sentinel << 2 ) | Curve::child( key ^ sentinel, level, q - 1 );
     }
 
-    int upper( int n ) const
+    // the number of levels below the root, from the position of the sentinel bit
+    static int level_of( index_element key )
     {
-        return (std::pow(4, n) - 1) / 3;
+#if defined( __GNUC__ )
+        return ( 63 - __builtin_clzll( key )) / 2;
+#else
+        int level = 0;
+
+        for ( ; key > 1; key >>= 2 )
+            ++level;
+
+        return level;
+#endif
     }
 
-    void populate_children( const rectangle_type & bounds, int parent, int level )
+    bool has_children( index_element key ) const
     {
-        int x = bounds.x();
-        int y = bounds.y();
-        int w = bounds.width();
-        int h = bounds.height();
+        return level_of( key ) < max_levels_ - 1;
+    }
+
+    // the column and row of a node's cell among those of its level
+    void cell_coordinates( index_element key, std::uint32_t & cx, std::uint32_t & cy ) const
+    {
+        const int level = level_of( key );
+
+        Curve::decode( key ^ ( index_element( 1 ) << ( 2 * level )), level, cx, cy );
+    }
+
+    /**
+     * The bounds of a node: the cells the locator maps to it, cx / 2^level
+     * up to ( cx + 1 ) / 2^level of the root's extent across (and likewise
+     * up), found from the same binary fractions the locator finds, so the
+     * nodes of each level tile the root however deep the tree. Edges are
+     * rounded outward, to whole units for integral coordinates, so a node's
+     * bounds hold every object placed in it.
+     */
+    rectangle_type node_bounds( index_element key ) const
+    {
+        const int level = level_of( key );
+        std::uint32_t cx, cy;
+
+        cell_coordinates( key, cx, cy );
 
-        unsigned parent_idx = index_[parent].to_ulong() << 2;
-        unsigned level_idx = parent_idx;
+        // scaling by a power of two is exact
+        const double cell = 1.0 / double( std::uint64_t( 1 ) << level );
+        const double x = double( bounds_.x() );
+        const double y = double( bounds_.y() );
+        const double w = double( bounds_.width() );
+        const double h = double( bounds_.height() );
 
-        // Quadtree nodes are added in Morton order, which is recorded in the
-        // index. A sentinel bit is set which corresponds to the level (depth)
-        // of the node, in order to ensure uniqueness of node ids.
+        const point_data_type x0 = lower_edge( x + w * ( cx * cell ));
+        const point_data_type y0 = lower_edge( y + h * ( cy * cell ));
+        const point_data_type x1 = upper_edge( x + w * (( cx + 1.0 ) * cell ));
+        const point_data_type y1 = upper_edge( y + h * (( cy + 1.0 ) * cell ));
 
-        bounds_.push_back( { rectangle_type{ x, y, w/2, h/2 }, parent } );
-        index_.push_back( level_idx );
-        bounds_.push_back( { rectangle_type{ x + w/2, y, w/2, h/2 }, parent } );
-        index_.push_back( level_idx | 1 );
-        bounds_.push_back( { rectangle_type{ x, y + h/2, w/2, h/2 }, parent } );
-        index_.push_back( level_idx | 2 );
-        bounds_.push_back( { rectangle_type{ x + w/2, y + h/2, w/2, h/2 }, parent } );
-        index_.push_back( level_idx | 3 );
+        return rectangle_type( x0, y0, x1 - x0, y1 - y0 );
     }
 
 private:
 
-    quad_node_array         bounds_;
-    index_type              index_;
+    rectangle_type          bounds_;
     int                     max_levels_;
-    container_type          objects_;
+    index_type              keys_;          // the node key of each object, ascending
+    container_type          objects_;       // the objects, in the order of keys_
 };
 
 #endif
@@ -1,15 +1,51 @@
 #include "quadtree.h"
+#include "concurrent_quadtree.h"
+#include "hilbert.h"
 #include "linear_quadtree.h"
+#include "orthtree.h"
+#include "quadtree_view.h"
+#include "snapshot_tree.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
 #include <random>
 #include <ratio>
 
 using namespace std;
 
+// every heap allocation made by the program is counted, so that the query
+// paths can be checked to be allocation-free
+static std::atomic< std::size_t > allocation_count( 0 );
+
+void * operator new( std::size_t n )
+{
+    ++allocation_count;
+
+    if ( void * p = std::malloc( n ? n : 1 ))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete( void * p ) noexcept
+{
+    std::free( p );
+}
+
 
 //*
 template< typename T >
@@ -63,8 +99,39 @@ std::ostream & operator<<( std::ostream & os, const test_object<T> & t )
     os << "<test_object position:(" << t.x() << "," << t.y()
        << ") size:(" << t.width() << ", " << t.height()
        << ") data:" << t.data() << ">";
+    return os;
 }
 
+// a 3d object, for oct_tree: an axis-aligned box
+template< typename T >
+class test_box
+{
+public:
+
+    test_box( T x, T y, T z, T w, T h, T d, int data )
+
+        : x_( x ), y_( y ), z_( z ), w_( w ), h_( h ), d_( d ), data_( data )
+    {}
+
+    T       x() const       { return x_; }
+    T       y() const       { return y_; }
+    T       z() const       { return z_; }
+    T       width() const   { return w_; }
+    T       height() const  { return h_; }
+    T       depth() const   { return d_; }
+    int     data() const    { return data_; }
+
+private:
+
+    T       x_;
+    T       y_;
+    T       z_;
+    T       w_;
+    T       h_;
+    T       d_;
+    int     data_;
+};
+
 template< typename T >
 struct T_counter
 {
@@ -98,12 +165,14 @@ private:
     std::vector< T > & res_;
 };
 
-template< template <typename> class Quad_tree, class T, class Obj_type >
-int find_matches( const Quad_tree<T> & qtree, const Obj_type & o )
+template< class Quad_tree_type, class Obj_type >
+int find_matches( const Quad_tree_type & qtree, const Obj_type & o )
 {
+    typedef typename Quad_tree_type::value_type T;
+
     std::vector< T > res;
     qtree.for_each_match( o, [&res]( const T & obj ) { res.push_back( obj ); } );
-    cout << "(" << T_counter<Quad_tree<T>>::count++ << ")- number of potential collisions : " << res.size() << endl;
+    cout << "(" << T_counter<Quad_tree_type>::count++ << ")- number of potential collisions : " << res.size() << endl;
 
     /*
     for ( const T & item : res )
@@ -115,14 +184,16 @@ int find_matches( const Quad_tree<T> & qtree, const Obj_type & o )
     return res.size();
 }
 
-template< template <typename> class Quad_tree, class T, class Obj_type >
-int find_line_matches( const Quad_tree<T> & qtree, const Obj_type & o)
+template< class Quad_tree_type, class Obj_type >
+int find_line_matches( const Quad_tree_type & qtree, const Obj_type & o)
 {
+    typedef typename Quad_tree_type::value_type T;
+
     std::vector< T > res;
     qtree.line_intersect( o, [&res]( const T & obj ){ res.push_back( obj ); } );
     functor<T> f( res );
     qtree.first_line_intersect( o, f );
-    cout << "(" << T_counter<Quad_tree<T>>::count++ << ")- number of potential collisions : " << res.size() << endl;
+    cout << "(" << T_counter<Quad_tree_type>::count++ << ")- number of potential collisions : " << res.size() << endl;
 
     /*
     for ( const T & item : res )
@@ -143,8 +214,10 @@ void intersection_test()
 }
 
 
+// the ten fixed queries, once each, as a check of their results: see
+// bench.cpp ('make bench') for the timings
 template< typename Quad_tree_type >
-void test_quad_tree( Quad_tree_type & qtree, int n = 1 )
+void test_quad_tree( Quad_tree_type & qtree )
 {
     //quad_tree< test_object<int> > qtree( { 0, 0, 1000, 1000 }, 10, 10 );
 
@@ -157,10 +230,6 @@ void test_quad_tree( Quad_tree_type & qtree, int n = 1 )
     }
     //cout << "total number of objects : " << qtree.size() << endl;
 
-    auto start = chrono::high_resolution_clock::now();
-
-    for ( int i = 0; i < n; ++i )
-    {
     //*
     { // #1 : should retrieve 100 objects
 
@@ -242,22 +311,1063 @@ void test_quad_tree( Quad_tree_type & qtree, int n = 1 )
 
         auto num = find_line_matches( qtree, l );
     }
+}
+
+
+
+template< typename Quad_tree_type >
+void test_query_batch( const Quad_tree_type & qtree )
+{
+    // the bounding-box queries #1 - #7 of test_quad_tree, as a single batch
+    std::vector< rectangle<int> > queries = {
+        make_bounding_box( point<int>( 0, 0 ), point<int>( 999, 999 )),
+        make_bounding_box( point<int>( 0, 999 ), point<int>( 999, 0 )),
+        make_bounding_box( point<int>( 500, 500 ), point<int>( 999, 999 )),
+        make_bounding_box( point<int>( 0, 0 ), point<int>( 499, 499 )),
+        make_bounding_box( point<int>( 510, 510 ), point<int>( 510, 999 )),
+        make_bounding_box( point<int>( 999, 999 ), point<int>( 600, 600 )),
+        make_bounding_box( point<int>( 500, 500 ), point<int>( 500, 500 )) };
+
+    std::vector< int > counts( queries.size() );
+
+    qtree.query_batch( queries.begin(), queries.end(),
+        [&counts]( const typename Quad_tree_type::batch_result_type & matches )
+        {
+            for ( const auto & m : matches ) ++counts[ m.first ];
+        }, 4, true );
+
+    for ( size_t i = 0; i < counts.size(); ++i )
+    {
+        cout << "(batch #" << i + 1 << ")- matches : " << counts[ i ] << endl;
+    }
+}
+
+template< typename Quad_tree_type >
+void test_raycast( const Quad_tree_type & qtree )
+{
+    // test #9 cast in reverse; the object nearest to (999, 999) is entered
+    // through its top right corner
+    line_segment<int> l( point<int>( 999, 999 ), point<int>( 0, 0 ) );
+
+    auto hit = qtree.raycast( l );
+    assert( hit.object && hit.object->data() == 98 );
+    cout << "(raycast)- nearest : " << *hit.object << " at " << hit.point << ", t : " << hit.t << endl;
+
+    // hits on the diagonals of the objects, rather than their bounding boxes
+    typedef typename Quad_tree_type::value_type value_type;
+
+    hit = qtree.raycast( l, []( const value_type & o, const line_segment<int> & s )
+        {
+            return intersect( s, line_segment<int>( point<int>( o.x(), o.y() + o.height() ), point<int>( o.x() + o.width(), o.y() )));
+        });
+    assert( hit.object && hit.object->data() == 98 );
+    cout << "(raycast)- nearest diagonal : " << *hit.object << " at " << hit.point << ", t : " << hit.t << endl;
+}
+
+// objects reaching beyond the bounds of a 1000 x 1000 tree, across an
+// edge or lying wholly outside it: the trees hold them at the root, which
+// the queries pruning by the nodes' bounds must still search
+std::vector< test_object<int> > outside_objects()
+{
+    return { test_object<int>( 900, 5000, 10, 10, 1000 ),
+             test_object<int>( -50, 500, 10, 10, 1001 ),
+             test_object<int>( 1100, 1100, 10, 10, 1002 ),
+             test_object<int>( 995, 300, 20, 10, 1003 ) };
+}
+
+// the objects outside the tree, among others scattered over [200, 800]
+template< typename Quad_tree_type >
+void insert_outside_objects( Quad_tree_type & qtree )
+{
+    for ( int i = 0; i < 200; ++i )
+    {
+        qtree.insert( test_object<int>( 200 + ( i * 37 ) % 590, 200 + ( i * 91 ) % 590, 5, 5, i ));
+    }
+
+    for ( const auto & obj : outside_objects() )
+    {
+        qtree.insert( obj );
+    }
+}
+
+inline point<int> centre( const test_object<int> & obj )
+{
+    return point<int>( obj.x() + obj.width() / 2, obj.y() + obj.height() / 2 );
+}
+
+template< typename Quad_tree_type >
+void test_raycast_outside( Quad_tree_type && qtree )
+{
+    insert_outside_objects( qtree );
+
+    for ( const auto & obj : outside_objects() )
+    {
+        const point<int> c = centre( obj );
+        auto hit = qtree.raycast( line_segment<int>( point<int>( c.x() - 200, c.y() ), c ));
+
+        assert( hit.object && hit.object->data() == obj.data() );
+    }
+
+    cout << "(raycast)- objects beyond the bounds hit : " << outside_objects().size() << endl;
+}
+
+template< typename T, typename Instrument, typename Nodes >
+void test_line_intersect_packet( const quad_tree< T, Instrument, Nodes > & qtree )
+{
+    // the segments of tests #9 and #10, and their reverses, as one packet
+    std::vector< line_segment<int> > lines = {
+        line_segment<int>( point<int>( 0, 0 ), point<int>( 999, 999 )),
+        line_segment<int>( point<int>( 501, 501 ), point<int>( 999, 999 )),
+        line_segment<int>( point<int>( 999, 999 ), point<int>( 0, 0 )),
+        line_segment<int>( point<int>( 999, 999 ), point<int>( 501, 501 )) };
+
+    std::vector< int > counts( lines.size() );
+
+    qtree.template line_intersect_packet< 4 >( lines.begin(), lines.end(),
+        [&counts]( std::size_t i, const T & ) { ++counts[ i ]; } );
+
+    for ( size_t i = 0; i < lines.size(); ++i )
+    {
+        int n = 0;
+        qtree.line_intersect( lines[ i ], [&n]( const T & ) { ++n; } );
+        assert( counts[ i ] == n );
+
+        cout << "(packet #" << i + 1 << ")- number of potential collisions : " << counts[ i ] << endl;
+    }
+}
+
+template< typename Quad_tree_type >
+void test_within_radius( const Quad_tree_type & qtree )
+{
+    // objects 49 and 50 touch (500, 500); 48 and 51 have a corner 14.1
+    // units from it, and 47 and 52 one 28.3 units away
+    typedef typename Quad_tree_type::value_type value_type;
+
+    int n = 0;
+    qtree.within_radius( point<int>( 500, 500 ), 15, [&n]( const value_type & ) { ++n; } );
+    assert( n == 4 );
+
+    cout << "(within radius)- number of objects within 15 of (500,500) : " << n << endl;
+}
+
+template< typename Quad_tree_type >
+void test_within_radius_outside( Quad_tree_type && qtree )
+{
+    typedef typename Quad_tree_type::value_type value_type;
+
+    insert_outside_objects( qtree );
+
+    for ( const auto & obj : outside_objects() )
+    {
+        std::vector< int > found;
+        qtree.within_radius( centre( obj ), 1, [&found]( const value_type & o ) { found.push_back( o.data() ); } );
+
+        assert( found.size() == 1 && found[ 0 ] == obj.data() );
+    }
+
+    cout << "(within radius)- objects beyond the bounds found : " << outside_objects().size() << endl;
+}
+
+template< typename T, typename Instrument, typename Nodes >
+void test_nearest( const quad_tree< T, Instrument, Nodes > & qtree )
+{
+    // (500, 500) is a corner of objects 49 and 50; the next nearest are
+    // 10 units away diagonally
+    std::vector< int > found;
+    qtree.nearest( point<int>( 500, 500 ), 2, [&found]( const T & obj ) { found.push_back( obj.data() ); } );
+
+    std::sort( found.begin(), found.end() );
+    assert( found.size() == 2 && found[ 0 ] == 49 && found[ 1 ] == 50 );
+
+    found.clear();
+    qtree.nearest( point<int>( 2000, 1500 ), 1, [&found]( const T & obj ) { found.push_back( obj.data() ); } );
+    assert( found.size() == 1 && found[ 0 ] == 98 );
+
+    cout << "(nearest)- nearest to (2000,1500) : " << found[ 0 ] << endl;
+}
+
+template< typename Quad_tree_type >
+void test_nearest_outside( Quad_tree_type && qtree )
+{
+    typedef typename Quad_tree_type::value_type value_type;
+
+    insert_outside_objects( qtree );
+
+    for ( const auto & obj : outside_objects() )
+    {
+        std::vector< int > found;
+        qtree.nearest( centre( obj ), 1, [&found]( const value_type & o ) { found.push_back( o.data() ); } );
+
+        assert( found.size() == 1 && found[ 0 ] == obj.data() );
+    }
+
+    // seen from (2000, 1105), object 1002 at (1100, 1100) is 890 away, but
+    // the corner of the tree 1005; an object spanning the right half of the
+    // tree at x = 1050 lies between them, at 940
+    qtree.insert( value_type( 1050, 0, 10, 1000, 1004 ));
+
+    std::vector< int > found;
+    qtree.nearest( point<int>( 2000, 1105 ), 1, [&found]( const value_type & o ) { found.push_back( o.data() ); } );
+    assert( found.size() == 1 && found[ 0 ] == 1002 );
+
+    cout << "(nearest)- objects beyond the bounds found : " << outside_objects().size() << endl;
+}
+
+template< typename T, typename Instrument, typename Nodes >
+void test_erase_move( quad_tree< T, Instrument, Nodes > & qtree )
+{
+    auto same = []( const T & a, const T & b ) { return a.data() == b.data(); };
+
+    // object 50 moves from (500, 500) to the top left corner, then goes
+    const T from( 500, 500, 10, 10, 50 );
+    const T to( 100, 900, 10, 10, 50 );
+
+    const bool moved = qtree.move( from, to, same );
+    assert( moved );
+
+    int n = 0;
+    qtree.for_each_match( point<int>( 105, 905 ), [&n]( const T & obj ) { n += obj.data() == 50; } );
+    assert( n == 1 );
+
+    const bool erased = qtree.erase( to, same );
+    const bool erased_again = qtree.erase( to, same );
+    assert( erased && !erased_again );
+
+    cout << "(erase/move)- objects : " << qtree.size() << ", nodes : " << qtree.node_count() << endl;
+}
+
+// a version of the world : 'count' objects scattered over it, each
+// tagged with the version number
+std::vector< test_object<int> > make_version( int version, int count )
+{
+    std::mt19937 rng( version );
+    std::uniform_int_distribution< int > position( 0, 989 );
+    std::vector< test_object<int> > objects;
+
+    for ( int i = 0; i < count; ++i )
+    {
+        objects.push_back( test_object<int>( position( rng ), position( rng ), 10, 10, version ));
+    }
+
+    return objects;
+}
+
+// erasing every object merges the tree back into its root, a leaf, though
+// the blocks of nodes released stay in the pool until clear()
+void test_erase_all()
+{
+    struct erase_tag {};
+    typedef query_statistics< erase_tag > statistics;
+
+    const std::vector< test_object<int> > objects = make_version( 1, 2000 );
+    quad_tree< test_object<int>, statistics > qtree( { 0, 0, 1000, 1000 }, 10, 10, objects.begin(), objects.end() );
+    const std::size_t nodes = qtree.node_count();
+
+    auto same = []( const test_object<int> & a, const test_object<int> & b )
+    {
+        return a.x() == b.x() && a.y() == b.y();
+    };
+
+    for ( const auto & obj : objects )
+    {
+        const bool erased = qtree.erase( obj, same );
+        assert( erased );
+    }
+
+    qtree.for_each_match( make_bounding_box( point<int>( 0, 0 ), point<int>( 999, 999 )), []( const test_object<int> & ) { assert( false ); } );
+    assert( qtree.size() == 0 && statistics::last().nodes == 1 && qtree.node_count() == nodes );
+
+    qtree.clear();
+    assert( qtree.node_count() == 1 );
+
+    cout << "(erase all)- nodes visited : " << statistics::last().nodes << ", nodes pooled : " << nodes << endl;
+}
+
+// a linear_quadtree bulk loaded from the objects of another must hold them
+// in the same nodes, so answer queries with the same objects
+template< typename T >
+void test_linear_bulk_load( const linear_quadtree< T > & lqtree )
+{
+    std::vector< T > objects;
+    lqtree.for_each_match( rectangle<int>( 0, 0, 1000, 1000 ), [&]( const T & obj ) { objects.push_back( obj ); } );
+
+    linear_quadtree< T > bulk( { 0, 0, 1000, 1000 }, 5, objects.begin(), objects.end() );
+
+    for ( int i = 0; i < 1000; i += 50 )
+    {
+        int expected = 0, actual = 0;
+        const rectangle<int> r( i, 1000 - i - 100, 100, 100 );
+
+        lqtree.for_each_match( r, [&]( const T & ) { ++expected; } );
+        bulk.for_each_match( r, [&]( const T & ) { ++actual; } );
+        assert( actual == expected );
+    }
+
+    cout << "(bulk load)- objects : " << bulk.size() << endl;
+    assert( bulk.size() == objects.size() );
+}
+
+// neighbours found by Morton arithmetic must be the adjacent cells, and the
+// range scan must find the objects the recursive query does
+template< typename T >
+void test_linear_neighbours( const linear_quadtree< T > & lqtree )
+{
+    typedef linear_quadtree< T > tree_type;
+
+    const typename tree_type::index_element key = lqtree.cell( point<int>( 500, 300 ), 3 );
+    const rectangle<int> b = lqtree.cell_bounds( key );
+
+    assert( lqtree.cell_bounds( tree_type::neighbour( key, tree_type::west )).x() < b.x() );
+    assert( lqtree.cell_bounds( tree_type::neighbour( key, tree_type::north )).y() > b.y() );
+    assert( tree_type::neighbour( tree_type::neighbour( key, tree_type::east ), tree_type::west ) == key );
+    assert( tree_type::neighbour( tree_type::neighbour( key, tree_type::south ), tree_type::north ) == key );
+    assert( tree_type::neighbour( lqtree.cell( point<int>( 0, 0 ), 3 ), tree_type::south ) == 0 );
+
+    // the non-empty cells of the deepest level, from its first to its last
+    int cells = 0;
+    lqtree.cells_in_range( lqtree.cell( point<int>( 0, 0 ), 4 ), lqtree.cell( point<int>( 999, 999 ), 4 ),
+                           [&]( typename tree_type::index_element ) { ++cells; } );
+
+    for ( int i = 0; i < 1000; i += 50 )
+    {
+        std::vector< const T * > expected, actual;
+        const rectangle<int> r( i, 1000 - i - 100, 100, 100 );
+
+        lqtree.for_each_match( r, [&]( const T & obj ) { expected.push_back( &obj ); } );
+        lqtree.for_each_match_ranges( r, [&]( const T & obj ) { actual.push_back( &obj ); } );
+
+        std::sort( expected.begin(), expected.end() );
+        std::sort( actual.begin(), actual.end() );
+        assert( actual == expected );
+    }
+
+    cout << "(neighbours)- non-empty deepest cells : " << cells << endl;
+}
+
+// a box query must find objects held below nodes holding none, such as a
+// lone object in a deepest cell, whose ancestors below the root are empty
+void test_linear_sparse()
+{
+    typedef test_object<int> T;
+
+    linear_quadtree< T > lqtree( { 0, 0, 1000, 1000 }, 5 );
+    lqtree.insert( T( 10, 10, 5, 5, 1 ));
+    lqtree.insert( T( 600, 900, 5, 5, 2 ));
+
+    int found = 0;
+    lqtree.for_each_match( rectangle<int>( 0, 0, 100, 100 ), [&]( const T & obj ) { assert( obj.data() == 1 ); ++found; } );
+    lqtree.for_each_match( rectangle<int>( 550, 850, 100, 100 ), [&]( const T & obj ) { assert( obj.data() == 2 ); ++found; } );
+
+    cout << "(sparse linear_quadtree)- objects found : " << found << endl;
+    assert( found == 2 );
+}
+
+// however deep the tree, and whatever the extent of its world, the nodes
+// of each level must tile it as the locator places objects, so box and
+// segment queries find every object they touch (some of them lying on the
+// world's right or top edge)
+template< typename Curve >
+void test_linear_deep( int levels = 20, int n = 2000 )
+{
+    typedef test_object<int> T;
+
+    const rectangle<int> world( -17, 3, 997, 1003 );
+    linear_quadtree< T, Curve > lqtree( world, levels );
+    std::vector< T > objects;
+
+    std::mt19937 rng( levels );
+    std::uniform_int_distribution< int > position( 0, 979 ), extent( 0, 20 );
+
+    for ( int i = 0; i < n; ++i )
+    {
+        T obj( position( rng ), position( rng ) + 3, extent( rng ), extent( rng ), i );
+
+        if ( i % 100 == 0 ) obj = T( 980, obj.y(), 0, 0, i );
+        if ( i % 100 == 1 ) obj = T( obj.x(), 1006, 0, 0, i );
+
+        lqtree.insert( obj );
+        objects.push_back( obj );
+    }
+
+    int found = 0;
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        const rectangle<int> r( position( rng ), position( rng ), extent( rng ) * 3, extent( rng ) * 3 );
+        const line_segment<int> l( point<int>( position( rng ), position( rng )), point<int>( position( rng ), position( rng )));
+
+        std::vector< int > matches, crossings;
+        lqtree.for_each_match( r, [&]( const T & obj ) { matches.push_back( obj.data() ); } );
+        lqtree.line_intersect( l, [&]( const T & obj ) { crossings.push_back( obj.data() ); } );
+
+        for ( const T & obj : objects )
+        {
+            const rectangle<int> b( obj.x(), obj.y(), obj.width(), obj.height() );
+
+            if ( obj.x() <= r.x() + r.width() && r.x() <= obj.x() + obj.width() &&
+                 obj.y() <= r.y() + r.height() && r.y() <= obj.y() + obj.height() )
+            {
+                assert( std::find( matches.begin(), matches.end(), obj.data() ) != matches.end() );
+                ++found;
+            }
+
+            if ( has_intersect( l, b ))
+            {
+                assert( std::find( crossings.begin(), crossings.end(), obj.data() ) != crossings.end() );
+                ++found;
+            }
+        }
+    }
+
+    cout << "(deep linear_quadtree)- levels : " << levels << ", objects found : " << found << endl;
+}
+
+// the diagonal of test_quad_tree, in an empty tree and one instrumented
+// with Stats_type, must give the same results from each, with every object
+// a query passes on counted as emitted, and every node a segment query
+// enters tested against it first
+template< typename Stats_type, typename Tree_type, typename Instrumented_type >
+void test_query_statistics( Tree_type & tree, Instrumented_type & instrumented, const char * name )
+{
+    typedef typename Tree_type::value_type T;
+
+    for ( int i = 0; i < 99; ++i )
+    {
+        tree.insert( test_object<int>( i * 10, i * 10, 10, 10, i ));
+        instrumented.insert( test_object<int>( i * 10, i * 10, 10, 10, i ));
+    }
+
+    Stats_type::reset();
+
+    for ( int i = 0; i < 1000; i += 50 )
+    {
+        const rectangle<int> r( i, 1000 - i - 100, 100, 100 );
+        const line_segment<int> l( point<int>( i, 0 ), point<int>( 999 - i, 999 ));
+
+        int expected = 0, actual = 0;
+
+        tree.for_each_match( r, [&]( const T & ) { ++expected; } );
+        instrumented.for_each_match( r, [&]( const T & ) { ++actual; } );
+
+        assert( actual == expected );
+        assert( Stats_type::last().emitted == std::uint64_t( actual ));
+        assert( Stats_type::last().nodes > 0 );
+
+        expected = actual = 0;
+
+        tree.line_intersect( l, [&]( const T & ) { ++expected; } );
+        instrumented.line_intersect( l, [&]( const T & ) { ++actual; } );
+
+        assert( actual == expected );
+        assert( Stats_type::last().emitted == std::uint64_t( actual ));
+        assert( Stats_type::last().edge_tests >= Stats_type::last().nodes );
+    }
+
+    const typename Stats_type::histograms & totals = Stats_type::totals();
+
+    assert( totals.queries == 40 );
+
+    cout << "(" << name << " statistics)- queries : " << totals.queries
+         << ", p99 nodes < " << totals.nodes.percentile( 99 )
+         << ", p99 edge tests < " << totals.edge_tests.percentile( 99 )
+         << ", p99 emitted < " << totals.emitted.percentile( 99 )
+         << ", depth < " << totals.depth.percentile( 100 ) << endl;
+}
+
+// an oct_tree must return every object overlapping a box query or touched
+// by a segment, and the same nearest objects as a search of every object,
+// whether it was bulk loaded or built by insert
+void test_oct_tree( int n = 5000 )
+{
+    typedef test_box<int> box_object;
+    typedef oct_tree< box_object > tree_type;
+
+    std::mt19937 rng( 23 );
+    std::uniform_int_distribution< int > position( 0, 989 ), extent( 1, 10 );
+    std::vector< box_object > objects;
+
+    for ( int i = 0; i < n; ++i )
+    {
+        objects.push_back( box_object( position( rng ), position( rng ), position( rng ), extent( rng ), extent( rng ), extent( rng ), i ));
+    }
+
+    const tree_type::box_type world = { { 0, 0, 0 }, { 1000, 1000, 1000 } };
+
+    tree_type inserted( world, 8, 8 );
+
+    for ( const box_object & o : objects ) inserted.insert( o );
+
+    const tree_type bulk( world, 8, 8, objects.begin(), objects.end() );
+
+    assert( inserted.size() == objects.size() && bulk.size() == objects.size() );
+    assert( inserted.node_count() == bulk.node_count() );
+
+    auto overlaps = []( const box_object & o, const tree_type::box_type & b )
+    {
+        return o.x() <= b.max[ 0 ] && o.x() + o.width() >= b.min[ 0 ] &&
+               o.y() <= b.max[ 1 ] && o.y() + o.height() >= b.min[ 1 ] &&
+               o.z() <= b.max[ 2 ] && o.z() + o.depth() >= b.min[ 2 ];
+    };
+
+    for ( int q = 0; q < 50; ++q )
+    {
+        const int x = position( rng ), y = position( rng ), z = position( rng ), size = 10 * extent( rng );
+        const tree_type::box_type query = { { x, y, z }, { x + size, y + size, z + size } };
+
+        std::vector< int > found[ 2 ];
+        inserted.for_each_match( query, [&]( const box_object & o ) { if ( overlaps( o, query )) found[ 0 ].push_back( o.data() ); } );
+        bulk.for_each_match( query, [&]( const box_object & o ) { if ( overlaps( o, query )) found[ 1 ].push_back( o.data() ); } );
+
+        int expected = 0;
+        for ( const box_object & o : objects ) expected += overlaps( o, query );
+
+        assert( int( found[ 0 ].size() ) == expected && int( found[ 1 ].size() ) == expected );
+
+        // a segment along the diagonal of the query box touches every
+        // object whose box holds one of its ends
+        const tree_type::line_type segment( vector_3d<int>( x, y, z ), vector_3d<int>( x + size, y + size, z + size ));
+        std::vector< int > crossed;
+        bulk.line_intersect( segment, [&]( const box_object & o ) { crossed.push_back( o.data() ); } );
+        std::sort( crossed.begin(), crossed.end() );
+
+        for ( const box_object & o : objects )
+        {
+            const tree_type::box_type end = { { x, y, z }, { x, y, z } };
+
+            if ( overlaps( o, end ))
+                assert( std::binary_search( crossed.begin(), crossed.end(), o.data() ));
+        }
+
+        // the distances of the 5 nearest, against those of every object
+        const vector_3d<int> p( x, y, z );
+        std::vector< double > nearest, all;
+
+        auto distance = [&p]( const box_object & o )
+        {
+            const double dx = std::max( std::max( double( o.x() ) - p.x(), double( p.x() ) - ( o.x() + o.width() )), 0.0 );
+            const double dy = std::max( std::max( double( o.y() ) - p.y(), double( p.y() ) - ( o.y() + o.height() )), 0.0 );
+            const double dz = std::max( std::max( double( o.z() ) - p.z(), double( p.z() ) - ( o.z() + o.depth() )), 0.0 );
+
+            return dx * dx + dy * dy + dz * dz;
+        };
+
+        inserted.nearest( p, 5, [&]( const box_object & o ) { nearest.push_back( distance( o )); } );
+
+        for ( const box_object & o : objects ) all.push_back( distance( o ));
+        std::sort( all.begin(), all.end() );
+
+        assert( nearest.size() == 5 && std::is_sorted( nearest.begin(), nearest.end() ));
+        assert( std::equal( nearest.begin(), nearest.end(), all.begin() ));
+    }
+
+    cout << "(oct_tree)- objects : " << bulk.size() << ", nodes : " << bulk.node_count() << endl;
+}
+
+// a tree saved and mapped back must answer queries as the tree itself
+// whether the image, damaged by edit, opens as a view
+template< typename T, typename Edit_type >
+bool opens_damaged( const std::string & image, const Edit_type & edit )
+{
+    const char * path = "quadtree.damaged";
+    std::string damaged = image;
+
+    edit( damaged );
+    std::ofstream( path, std::ios::binary ).write( damaged.data(), damaged.size() );
+
+    bool opened = true;
+
+    try
+    {
+        quad_tree_view< T >::open( path );
+    }
+    catch ( const std::runtime_error & )
+    {
+        opened = false;
+    }
+
+    std::remove( path );
+    return opened;
+}
+
+// a truncated or corrupt image must be refused when opened, rather than
+// read beyond
+template< typename T >
+void test_damaged_view( const char * path )
+{
+    typedef detail::image_header header_type;
+    typedef detail::image_node< int > node_type;
+
+    std::ifstream in( path, std::ios::binary );
+    const std::string image( ( std::istreambuf_iterator< char >( in )), std::istreambuf_iterator< char >() );
+
+    header_type header;
+    std::memcpy( &header, image.data(), sizeof( header ));
+
+    // writes v over the field at offset
+    auto set = []( std::string & image, std::size_t offset, const void * v, std::size_t n ) { std::memcpy( &image[ offset ], v, n ); };
+
+    // a node's field at offset within it
+    auto node_field = [&]( std::size_t i, std::size_t offset ) { return header.nodes_offset + i * sizeof( node_type ) + offset; };
+
+    node_type root;
+    std::memcpy( &root, image.data() + header.nodes_offset, sizeof( root ));
+    assert( root.first_child != detail::npos );
+
+    assert( opens_damaged< T >( image, []( std::string & ) {} ));
+
+    // cut short within the objects, then within the nodes
+    assert( !opens_damaged< T >( image, [&]( std::string & d ) { d.resize( header.objects_offset + sizeof( T ) / 2 ); } ));
+    assert( !opens_damaged< T >( image, [&]( std::string & d ) { d.resize( header.nodes_offset + sizeof( node_type ) / 2 ); } ));
+
+    // a count of objects whose size overflows 64 bits
+    assert( !opens_damaged< T >( image, [&]( std::string & d )
+    {
+        const std::uint64_t count = std::numeric_limits< std::uint64_t >::max() / sizeof( T ) + 2;
+        set( d, offsetof( header_type, object_count ), &count, sizeof( count ));
+    }));
+
+    // children beyond the nodes, children shared with another node, and
+    // the root as a child
+    assert( !opens_damaged< T >( image, [&]( std::string & d )
+    {
+        const std::int32_t first = std::int32_t( header.node_count - 2 );
+        set( d, node_field( 0, offsetof( node_type, first_child )), &first, sizeof( first ));
+    }));
+    assert( !opens_damaged< T >( image, [&]( std::string & d )
+    {
+        set( d, node_field( root.first_child, offsetof( node_type, first_child )), &root.first_child, sizeof( root.first_child ));
+    }));
+    assert( !opens_damaged< T >( image, [&]( std::string & d )
+    {
+        const std::int32_t first = 0;
+        set( d, node_field( 0, offsetof( node_type, first_child )), &first, sizeof( first ));
+    }));
+
+    // objects beyond the objects held
+    assert( !opens_damaged< T >( image, [&]( std::string & d )
+    {
+        const std::uint64_t first = header.object_count - root.object_count + 1;
+        set( d, node_field( 0, offsetof( node_type, first_object )), &first, sizeof( first ));
+    }));
+
+    cout << "(view)- damaged images refused" << endl;
+}
+
+template< typename T, typename Instrument, typename Nodes >
+void test_save_view( const quad_tree< T, Instrument, Nodes > & qtree )
+{
+    const char * path = "quadtree.image";
+    qtree.save( path );
+
+    {
+        const quad_tree_view< T > view = quad_tree_view< T >::open( path );
+        std::vector< T > expected, actual;
+
+        const auto bb = make_bounding_box( point<int>( 100, 300 ), point<int>( 700, 800 ));
+        const line_segment<int> l( point<int>( 999, 0 ), point<int>( 0, 999 ));
+
+        qtree.for_each_match( bb, [&]( const T & obj ) { expected.push_back( obj ); } );
+        qtree.line_intersect( l, [&]( const T & obj ) { expected.push_back( obj ); } );
+        view.for_each_match( bb, [&]( const T & obj ) { actual.push_back( obj ); } );
+        view.line_intersect( l, [&]( const T & obj ) { actual.push_back( obj ); } );
+
+        auto same = []( const T & a, const T & b ) { return a.x() == b.x() && a.y() == b.y() && a.data() == b.data(); };
+
+        cout << "(view)- objects : " << view.size() << ", nodes : " << view.node_count() << ", matches : " << actual.size() << endl;
+        assert( view.size() == qtree.size() && view.node_count() == qtree.node_count() );
+        assert( actual.size() == expected.size() && std::equal( actual.begin(), actual.end(), expected.begin(), same ));
+    }
+
+    // a loose tree of looseness 1 still places objects by their centre, so
+    // its view must query it as a loose tree: the first object reaches the
+    // midline, yet is held by a lower-left child
+    {
+        typedef test_object<int> object_type;
+
+        loose_quad_tree< object_type > loose( { 0, 0, 1000, 1000 }, 4, 1, 1.0 );
+        loose.insert( object_type( 490, 100, 10, 10, 1 ));
+        loose.insert( object_type( 100, 800, 10, 10, 2 ));
+        loose.insert( object_type( 800, 800, 10, 10, 3 ));
+        loose.save( path );
+
+        const quad_tree_view< object_type > view = quad_tree_view< object_type >::open( path );
+        int in_tree = 0, in_view = 0;
+
+        loose.for_each_match( point<int>( 500, 105 ), [&]( const object_type & ) { ++in_tree; } );
+        view.for_each_match( point<int>( 500, 105 ), [&]( const object_type & ) { ++in_view; } );
+
+        assert( loose.node_count() > 1 && in_tree == 1 && in_view == in_tree );
     }
 
+    qtree.save( path );
+    test_damaged_view< T >( path );
+    std::remove( path );
+}
+
+// readers query the published versions while a writer rebuilds and
+// publishes new ones; every read must see a single whole version, and
+// versions must never go backwards
+void test_snapshot( unsigned readers = 3, int versions = 200, int count = 500 )
+{
+    typedef quad_tree< test_object<int> > tree_type;
+
+    const rectangle<int> world( 0, 0, 1000, 1000 );
+    std::vector< test_object<int> > objects = make_version( 0, count );
+
+    snapshot_tree< tree_type > snapshots( std::unique_ptr< tree_type >( new tree_type( world, 10, 10, objects.begin(), objects.end() )));
+
+    std::atomic< bool > done( false );
+    std::atomic< long > reads( 0 );
+    std::size_t max_retired = 0;
+
+    auto start = chrono::high_resolution_clock::now();
+
+    detail::run_workers( readers + 1, [&]( unsigned worker )
+    {
+        if ( worker == 0 )
+        {
+            for ( int v = 1; v <= versions; ++v )
+            {
+                objects = make_version( v, count );
+                snapshots.emplace( world, 10, 10, objects.begin(), objects.end() );
+                max_retired = std::max( max_retired, snapshots.reclaim() );
+            }
+
+            done = true;
+            return;
+        }
+
+        snapshot_tree< tree_type >::reader reader( snapshots );
+        int last = 0;
+        long n = 0;
+
+        while ( !done )
+        {
+            reader.read( [&]( const tree_type & t )
+            {
+                int seen = 0, version = -1;
+
+                t.for_each_overlap( make_bounding_box( point<int>( 0, 0 ), point<int>( 999, 999 )), [&]( const test_object<int> & obj )
+                {
+                    if ( version < 0 ) version = obj.data();
+                    assert( obj.data() == version );
+                    ++seen;
+                });
+
+                assert( seen == count && version >= last );
+                last = version;
+            });
+
+            ++n;
+        }
+
+        reads += n;
+    });
+
     auto end = chrono::high_resolution_clock::now();
+    const std::size_t retired = snapshots.reclaim();
+
+    cout << "(snapshot)- readers : " << readers << ", versions : " << versions << ", reads : " << reads
+         << ", most retired : " << max_retired << ", left retired : " << retired
+         << ", sec : " << chrono::duration_cast< chrono::duration< double > >( end - start ).count() << endl;
+    assert( retired == 0 );
+}
+
+// inserts n objects from each of 'threads' threads, with another thread
+// querying throughout; once done, the tree must hold every object, and be
+// shaped as a quad_tree built from the same objects
+void test_concurrent_insert( unsigned threads = 4, int n = 5000 )
+{
+    const rectangle<int> world( 0, 0, 1000, 1000 );
+    std::vector< test_object<int> > objects;
+
+    // tagged with their position in objects
+    for ( unsigned t = 0; t < threads; ++t )
+    {
+        for ( const auto & obj : make_version( int( t ), n ))
+        {
+            objects.push_back( test_object<int>( obj.x(), obj.y(), obj.width(), obj.height(), int( objects.size() )));
+        }
+    }
+
+    concurrent_quad_tree< test_object<int> > ctree( world, 10, 10 );
+    std::atomic< bool > done( false );
+    long checked = 0;
+
+    // the number of each thread's inserts which have returned
+    std::unique_ptr< std::atomic< int >[] > completed( new std::atomic< int >[ threads ] );
+
+    for ( unsigned t = 0; t < threads; ++t )
+    {
+        completed[ t ] = 0;
+    }
+
+    detail::run_workers( threads + 1, [&]( unsigned worker )
+    {
+        if ( worker == threads )
+        {
+            // every object whose insert had returned must be counted and
+            // found, however the splits running meanwhile move it
+            std::vector< int > returned( threads );
+            std::vector< char > seen( objects.size() );
+
+            while ( !done )
+            {
+                std::size_t total = 0;
+
+                for ( unsigned t = 0; t < threads; ++t )
+                {
+                    returned[ t ] = completed[ t ];
+                    total += returned[ t ];
+                }
+
+                assert( ctree.size() >= total );
+
+                std::fill( seen.begin(), seen.end(), 0 );
+                auto see = [&]( const test_object<int> & obj ) { seen[ obj.data() ] = 1; };
+
+                if ( checked % 2 ) ctree.for_each_overlap( world, see );
+                else               ctree.for_each_match( world, see );
+
+                for ( unsigned t = 0; t < threads; ++t )
+                {
+                    for ( int i = 0; i < returned[ t ]; ++i )
+                    {
+                        assert( seen[ t * n + i ] );
+                    }
+                }
+
+                ++checked;
+            }
+
+            return;
+        }
+
+        for ( int i = 0; i < n; ++i )
+        {
+            ctree.insert( objects[ worker * n + i ] );
+            completed[ worker ] = i + 1;
+
+            // so that the checks interleave with the inserts even on a
+            // single core
+            std::this_thread::yield();
+        }
 
-    cout << "Time taken: " << chrono::duration<double, milli >(end-start).count() << " ms\n";
+        if ( worker == 0 )
+        {
+            // the other inserting threads are joined after this one returns
+            for ( unsigned t = 0; t < threads; ++t )
+            {
+                while ( completed[ t ] < n ) std::this_thread::yield();
+            }
+
+            done = true;
+        }
+    });
+
+    quad_tree< test_object<int> > serial( world, 10, 10, objects.begin(), objects.end() );
+
+    for ( std::size_t i = 0; i < objects.size(); i += 97 )
+    {
+        int found = 0;
+
+        ctree.for_each_overlap( objects[ i ], [&]( const test_object<int> & obj )
+        {
+            found += obj.x() == objects[ i ].x() && obj.y() == objects[ i ].y() && obj.data() == objects[ i ].data();
+        });
+
+        assert( found > 0 );
+    }
+
+    cout << "(concurrent insert)- objects : " << ctree.size() << ", nodes : " << ctree.node_count()
+         << ", quad_tree nodes : " << serial.node_count() << ", checked while inserting : " << checked << endl;
+    assert( ctree.size() == objects.size() && ctree.node_count() == serial.node_count() );
 }
 
+template< typename T >
+struct counting_functor
+{
+    counting_functor( int & n )
+        : n_( n )
+    {}
 
+    void operator()( const T & ) const  { ++n_; }
+    bool active() const                 { return true; }
+
+    int & n_;
+};
+
+template< typename Function_type >
+std::size_t allocations( const Function_type & f )
+{
+    const std::size_t before = allocation_count;
+    f();
+    return allocation_count - before;
+}
+
+// the queries shared by quad_tree and linear_quadtree, which must not
+// allocate once the tree has been built
+template< typename Quad_tree_type >
+std::size_t common_query_allocations( const Quad_tree_type & qtree, int & n )
+{
+    typedef typename Quad_tree_type::value_type value_type;
+    counting_functor< value_type > f( n );
+
+    return allocations( [&]()
+    {
+        qtree.for_each_match( make_bounding_box( point<int>( 0, 0 ), point<int>( 999, 999 )), f );
+        qtree.for_each_match( make_bounding_box( point<int>( 510, 510 ), point<int>( 510, 999 )), f );
+        qtree.for_each_match( point<int>( 500, 500 ), f );
+        qtree.line_intersect( line_segment<int>( point<int>( 0, 0 ), point<int>( 999, 999 )), f );
+        qtree.first_line_intersect( line_segment<int>( point<int>( 501, 501 ), point<int>( 999, 999 )), f );
+        qtree.within_radius( point<int>( 500, 500 ), 50, f );
+        n += qtree.raycast( line_segment<int>( point<int>( 999, 999 ), point<int>( 0, 0 ))).object != nullptr;
+    });
+}
+
+template< typename T >
+std::size_t query_allocations( const linear_quadtree< T > & qtree, int & n )
+{
+    return common_query_allocations( qtree, n );
+}
+
+template< typename T, typename Instrument, typename Nodes >
+std::size_t query_allocations( const quad_tree< T, Instrument, Nodes > & qtree, int & n )
+{
+    counting_functor< T > f( n );
+
+    return common_query_allocations( qtree, n ) + allocations( [&]()
+    {
+        qtree.for_each_match_iterative( make_bounding_box( point<int>( 0, 0 ), point<int>( 999, 999 )), f );
+        qtree.for_each_overlap( make_bounding_box( point<int>( 500, 500 ), point<int>( 999, 999 )), f );
+        qtree.line_intersect_iterative( line_segment<int>( point<int>( 0, 0 ), point<int>( 999, 999 )), f );
+        qtree.nearest( point<int>( 500, 500 ), 8, f );
+    });
+}
+
+template< typename Quad_tree_type >
+void test_query_allocations( const Quad_tree_type & qtree )
+{
+    int matches = 0;
+    const std::size_t n = query_allocations( qtree, matches );
+
+    cout << "(allocations)- matches : " << matches << ", heap allocations : " << n << endl;
+    assert( n == 0 );
+}
+
+// the box of a scalar held in an object_bucket: the point (v, v)
+template< typename T >
+struct scalar_box
+{
+    detail::box< T > operator()( T v ) const
+    {
+        detail::box< T > b = { v, v, v, v };
+        return b;
+    }
+};
+
+// the SoA overlap tests of the buckets, with a partly filled last block
+// and queries as wide as the type, which the padding lanes overlap too
+template< typename T >
+void test_object_bucket( T lowest, T highest )
+{
+    detail::object_bucket< T, T, scalar_box< T > > bucket;
+    const detail::box< T > everything = { lowest, lowest, highest, highest };
+    const detail::box< T > some = { T( 2 ), T( 2 ), T( 4 ), T( 4 ) };
+
+    for ( int n = 0; n < 10; ++n )
+    {
+        int all = 0, found = 0;
+
+        bucket.for_each_overlap( everything, [&]( T ) { ++all; } );
+        bucket.for_each_overlap( some, [&]( T v ) { assert( v >= T( 2 ) && v <= T( 4 )); ++found; } );
+
+        assert( all == n );
+        assert( found == std::max( 0, std::min( n, 5 ) - 2 ));
+        assert( bucket.find_if( everything, []( T ) { return false; } ) == bucket.size() );
+        assert( bucket.find_if( everything, [&]( T v ) { return v == T( n - 1 ); } ) == std::size_t( n ? n - 1 : 0 ));
+
+        bucket.push_back( T( n ));
+    }
+
+    // and again after erasing, which refills the emptied lanes
+    while ( !bucket.empty() )
+    {
+        bucket.erase( 0 );
+
+        int all = 0;
+        bucket.for_each_overlap( everything, [&]( T ) { ++all; } );
+        assert( all == int( bucket.size() ));
+    }
+}
 
 int main()
 {
     quad_tree< test_object<int> > qtree( { 0, 0, 1000, 1000 }, 10, 10 );
-    test_quad_tree( qtree, 500 );
+    test_quad_tree( qtree );
+    test_query_batch( qtree );
+    test_query_allocations( qtree );
+    test_raycast( qtree );
+    test_raycast_outside( quad_tree< test_object<int> >( { 0, 0, 1000, 1000 }, 10, 10 ));
+    test_within_radius( qtree );
+    test_within_radius_outside( quad_tree< test_object<int> >( { 0, 0, 1000, 1000 }, 10, 10 ));
+    test_line_intersect_packet( qtree );
+    test_nearest( qtree );
+    test_nearest_outside( quad_tree< test_object<int> >( { 0, 0, 1000, 1000 }, 10, 10 ));
+    test_erase_move( qtree );
+    test_erase_all();
+    test_save_view( qtree );
 
     linear_quadtree< test_object<int> > lqtree( { 0, 0, 1000, 1000 }, 5 );
-    test_quad_tree( lqtree, 500 );
+    test_quad_tree( lqtree );
+    test_query_batch( lqtree );
+    test_query_allocations( lqtree );
+    test_raycast( lqtree );
+    test_raycast_outside( linear_quadtree< test_object<int> >( { 0, 0, 1000, 1000 }, 5 ));
+    test_within_radius( lqtree );
+    test_within_radius_outside( linear_quadtree< test_object<int> >( { 0, 0, 1000, 1000 }, 5 ));
+    test_linear_bulk_load( lqtree );
+    test_linear_neighbours( lqtree );
+    test_linear_sparse();
+    test_linear_deep< morton_curve >();
+    test_linear_deep< hilbert_curve >();
+
+    struct quad_tree_tag {};
+    struct linear_quadtree_tag {};
+    typedef query_statistics< quad_tree_tag > quad_tree_statistics;
+    typedef query_statistics< linear_quadtree_tag > linear_quadtree_statistics;
+
+    quad_tree< test_object<int> > plain( { 0, 0, 1000, 1000 }, 10, 10 );
+    quad_tree< test_object<int>, quad_tree_statistics > instrumented( { 0, 0, 1000, 1000 }, 10, 10 );
+    test_query_statistics< quad_tree_statistics >( plain, instrumented, "quad_tree" );
+
+    linear_quadtree< test_object<int> > linear_plain( { 0, 0, 1000, 1000 }, 5 );
+    linear_quadtree< test_object<int>, morton_curve, linear_quadtree_statistics > linear_instrumented( { 0, 0, 1000, 1000 }, 5 );
+    test_query_statistics< linear_quadtree_statistics >( linear_plain, linear_instrumented, "linear_quadtree" );
+
+    // as quad_tree, with the objects straddling a midline moved down into
+    // the children whose doubled bounds hold them
+    loose_quad_tree< test_object<int> > loose( { 0, 0, 1000, 1000 }, 10, 10 );
+    test_quad_tree( loose );
+    test_query_batch( loose );
+    test_query_allocations( loose );
+    test_raycast( loose );
+    test_raycast_outside( loose_quad_tree< test_object<int> >( { 0, 0, 1000, 1000 }, 10, 10 ));
+    test_within_radius( loose );
+    test_within_radius_outside( loose_quad_tree< test_object<int> >( { 0, 0, 1000, 1000 }, 10, 10 ));
+    test_line_intersect_packet( loose );
+    test_nearest( loose );
+    test_nearest_outside( loose_quad_tree< test_object<int> >( { 0, 0, 1000, 1000 }, 10, 10 ));
+    test_erase_move( loose );
+    test_save_view( loose );
+
+    test_object_bucket< int >( numeric_limits< int >::lowest(), numeric_limits< int >::max() );
+    test_object_bucket< float >( -numeric_limits< float >::infinity(), numeric_limits< float >::infinity() );
+    test_object_bucket< double >( numeric_limits< double >::lowest(), numeric_limits< double >::max() );
+    cout << "(object_bucket)- full-range queries see only the objects held" << endl;
 
+    test_snapshot();
+    test_concurrent_insert();
+    test_oct_tree();
 }
 
@@ -0,0 +1,312 @@
+#ifndef QUADTREE_MORTON_H
+#define QUADTREE_MORTON_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#if defined( __BMI2__ )
+#include <immintrin.h>
+#endif
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * @brief spread_bits
+     *
+     * Moves bit i of v to bit 2i, clearing the odd bits.
+     */
+    inline std::uint64_t spread_bits( std::uint32_t v )
+    {
+#if defined( __BMI2__ )
+        return _pdep_u64( v, 0x5555555555555555ull );
+#else
+        std::uint64_t x = v;
+
+        x = ( x | ( x << 16 )) & 0x0000FFFF0000FFFFull;
+        x = ( x | ( x << 8 ))  & 0x00FF00FF00FF00FFull;
+        x = ( x | ( x << 4 ))  & 0x0F0F0F0F0F0F0F0Full;
+        x = ( x | ( x << 2 ))  & 0x3333333333333333ull;
+        x = ( x | ( x << 1 ))  & 0x5555555555555555ull;
+
+        return x;
+#endif
+    }
+
+    /**
+     * @brief compact_bits
+     *
+     * The inverse of spread_bits: moves bit 2i of v to bit i, dropping the
+     * odd bits.
+     */
+    inline std::uint32_t compact_bits( std::uint64_t v )
+    {
+#if defined( __BMI2__ )
+        return std::uint32_t( _pext_u64( v, 0x5555555555555555ull ));
+#else
+        std::uint64_t x = v & 0x5555555555555555ull;
+
+        x = ( x | ( x >> 1 ))  & 0x3333333333333333ull;
+        x = ( x | ( x >> 2 ))  & 0x0F0F0F0F0F0F0F0Full;
+        x = ( x | ( x >> 4 ))  & 0x00FF00FF00FF00FFull;
+        x = ( x | ( x >> 8 ))  & 0x0000FFFF0000FFFFull;
+        x = ( x | ( x >> 16 )) & 0x00000000FFFFFFFFull;
+
+        return std::uint32_t( x );
+#endif
+    }
+
+    // the bits of a Morton code (without sentinel) holding x and y
+    enum : std::uint64_t { morton_x_bits = 0x5555555555555555ull, morton_y_bits = 0xAAAAAAAAAAAAAAAAull };
+
+    /**
+     * @brief morton_step
+     *
+     * Adds one to (or, with step -1, subtracts one from) the coordinate
+     * held in the bits 'dimension' (morton_x_bits or morton_y_bits) of the
+     * Morton code z, directly on the dilated (interleaved) integer: the
+     * other coordinate's bits are filled, so that the carry or borrow
+     * passes straight over them. Wraps at the ends of the coordinate's
+     * range, as ordinary unsigned arithmetic does.
+     */
+    inline std::uint64_t morton_step( std::uint64_t z, std::uint64_t dimension, int step )
+    {
+        const std::uint64_t other = ~dimension;
+
+        const std::uint64_t moved = step > 0 ? ( ( z | other ) + 1 ) & dimension
+                                             : ( ( z & dimension ) - 1 ) & dimension;
+
+        return moved | ( z & other );
+    }
+
+    /**
+     * @brief bigmin
+     *
+     * Given the Morton codes zmin and zmax (of 'bits' bits each) of the
+     * lower left and upper right cells of a rectangle of cells, and a code
+     * z lying between them but outside the rectangle, returns the smallest
+     * code greater than z which lies within the rectangle (Tropf and
+     * Herzog's BIGMIN). A scan of codes in ascending order can jump to it,
+     * skipping every code in between.
+     */
+    inline std::uint64_t bigmin( std::uint64_t z, std::uint64_t zmin, std::uint64_t zmax, int bits )
+    {
+        std::uint64_t result = 0;
+
+        for ( int b = bits - 1; b >= 0; --b )
+        {
+            const std::uint64_t bit = std::uint64_t( 1 ) << b;
+
+            // the lower bits of the same coordinate as bit b
+            const std::uint64_t below = ( b & 1 ? morton_y_bits : morton_x_bits ) & ( bit - 1 );
+
+            // zmin or zmax, with bit b set to 1 (0) and the lower bits of
+            // its coordinate to 0 (1): the first code of the upper half, or
+            // the last of the lower half, of the range along that coordinate
+            const std::uint64_t upper_first = ( zmin & ~below ) | bit;
+            const std::uint64_t lower_last = ( zmax & ~bit ) | below;
+
+            switch ( ( z & bit ? 4 : 0 ) | ( zmin & bit ? 2 : 0 ) | ( zmax & bit ? 1 : 0 ))
+            {
+            case 1:                         // 0 0 1 : the range straddles z's half
+                result = upper_first;
+                zmax = lower_last;
+                break;
+
+            case 3:                         // 0 1 1 : the range lies wholly above
+                return zmin;
+
+            case 4:                         // 1 0 0 : the range lies wholly below
+                return result;
+
+            case 5:                         // 1 0 1 : continue in the upper half
+                zmin = upper_first;
+                break;
+
+            default:                        // 0 0 0 and 1 1 1 : z's half, as is
+                break;
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief cell_coordinate
+     *
+     * The column (or row) of the deepest cells, 2^depth across, holding the
+     * position d, a fraction of the width (or height) of the tree: the first
+     * depth bits of the fractional part of d as a binary fraction, or 0 for
+     * a negative d.
+     */
+    inline std::uint32_t cell_coordinate( double d, int depth )
+    {
+        const double f = d - double( int( d ));
+
+        // scaling by a power of two is exact, so this truncates the binary
+        // fraction to depth bits
+        return f > 0.0 ? std::uint32_t( f * double( std::uint64_t( 1 ) << depth )) : 0;
+    }
+
+    /**
+     * @brief cell_key
+     *
+     * The Morton key of the deepest cell holding the point dx, dy from the
+     * origin of a tree of the given width and height, depth levels below its
+     * root: a sentinel bit at 2 * depth, followed by the bits of the cell's
+     * row and column, interleaved (y then x), most significant first.
+     */
+    inline std::uint64_t cell_key( double dx, double dy, double width, double height, int depth )
+    {
+        return ( std::uint64_t( 1 ) << ( depth * 2 )) |
+               ( spread_bits( cell_coordinate( dy / height, depth )) << 1 ) |
+               spread_bits( cell_coordinate( dx / width, depth ));
+    }
+
+    /**
+     * @brief cell_keys
+     *
+     * As cell_key, for the n points dx[ i ], dy[ i ], writing keys[ i ].
+     */
+    inline void cell_keys( const double * dx, const double * dy, std::size_t n,
+                           double width, double height, int depth, std::uint64_t * keys )
+    {
+        std::size_t i = 0;
+
+#if defined( __SSE2__ )
+        const __m128d w = _mm_set1_pd( width );
+        const __m128d h = _mm_set1_pd( height );
+        const __m128d scale = _mm_set1_pd( double( std::uint64_t( 1 ) << depth ));
+        const __m128d zero = _mm_setzero_pd();
+        const __m128i sentinel = _mm_set1_epi64x( std::int64_t( std::uint64_t( 1 ) << ( depth * 2 )));
+
+        // the columns (rows) of two points, as in cell_coordinate
+        auto coordinates = [&]( __m128d d )
+        {
+            const __m128d f = _mm_max_pd( _mm_sub_pd( d, _mm_cvtepi32_pd( _mm_cvttpd_epi32( d ))), zero );
+
+            return _mm_unpacklo_epi32( _mm_cvttpd_epi32( _mm_mul_pd( f, scale )), _mm_setzero_si128() );
+        };
+
+        // as spread_bits, in each 64 bit lane
+        auto spread = []( __m128i x )
+        {
+            x = _mm_and_si128( _mm_or_si128( x, _mm_slli_epi64( x, 16 )), _mm_set1_epi64x( 0x0000FFFF0000FFFFll ));
+            x = _mm_and_si128( _mm_or_si128( x, _mm_slli_epi64( x, 8 )),  _mm_set1_epi64x( 0x00FF00FF00FF00FFll ));
+            x = _mm_and_si128( _mm_or_si128( x, _mm_slli_epi64( x, 4 )),  _mm_set1_epi64x( 0x0F0F0F0F0F0F0F0Fll ));
+            x = _mm_and_si128( _mm_or_si128( x, _mm_slli_epi64( x, 2 )),  _mm_set1_epi64x( 0x3333333333333333ll ));
+            x = _mm_and_si128( _mm_or_si128( x, _mm_slli_epi64( x, 1 )),  _mm_set1_epi64x( 0x5555555555555555ll ));
+
+            return x;
+        };
+
+        for ( ; i + 2 <= n; i += 2 )
+        {
+            const __m128i x = spread( coordinates( _mm_div_pd( _mm_loadu_pd( dx + i ), w )));
+            const __m128i y = spread( coordinates( _mm_div_pd( _mm_loadu_pd( dy + i ), h )));
+
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( keys + i ),
+                              _mm_or_si128( sentinel, _mm_or_si128( _mm_slli_epi64( y, 1 ), x )));
+        }
+#endif
+
+        for ( ; i < n; ++i )
+        {
+            keys[ i ] = cell_key( dx[ i ], dy[ i ], width, height, depth );
+        }
+    }
+}
+
+/**
+ *
+ * morton_curve orders the cells of each level of a linear_quadtree along the
+ * Z-order (Morton) curve: a cell's code is its row and column, interleaved.
+ *
+ * It is one of linear_quadtree's curve policies (see also hilbert_curve),
+ * each of which provides, for the code z (2 * level bits, without the
+ * sentinel bit) of a cell at a level below the root:
+ *
+ *  - encode and decode, between a cell's column and row and its code;
+ *  - child, the code of quadrant q (0 - 3: bit 0 set for the right half,
+ *    bit 1 for the upper) of a cell;
+ *  - step, the code of the cell adjacent along one axis, if any;
+ *  - next_in_rect, the smallest code at least z of a cell in a rectangle
+ *    of cells, if any;
+ *  - cell_key and cell_keys, the key (with the sentinel bit) of the
+ *    deepest cell holding a point, as detail::cell_key and cell_keys.
+ *
+ * Both curves visit all of a cell's descendants at a level before moving
+ * on, so the codes of a cell's descendants form one range, and a parent's
+ * code is its child's shifted right by two bits.
+ *
+ */
+struct morton_curve
+{
+    static std::uint64_t encode( std::uint32_t x, std::uint32_t y, int )
+    {
+        return detail::spread_bits( x ) | ( detail::spread_bits( y ) << 1 );
+    }
+
+    static void decode( std::uint64_t z, int, std::uint32_t & x, std::uint32_t & y )
+    {
+        x = detail::compact_bits( z );
+        y = detail::compact_bits( z >> 1 );
+    }
+
+    static std::uint64_t child( std::uint64_t z, int, int q )
+    {
+        return ( z << 2 ) | std::uint64_t( q );
+    }
+
+    // axis 0 steps x, 1 steps y, by step (1 or -1), on the dilated integer
+    static bool step( std::uint64_t z, int level, int axis, int step, std::uint64_t & result )
+    {
+        const std::uint64_t dimension = ( axis == 0 ? detail::morton_x_bits : detail::morton_y_bits ) &
+                                        (( std::uint64_t( 1 ) << ( 2 * level )) - 1 );
+
+        if (( z & dimension ) == ( step > 0 ? dimension : 0 )) return false;
+
+        result = detail::morton_step( z, dimension, step );
+        return true;
+    }
+
+    static bool next_in_rect( std::uint64_t z, int level, std::uint32_t x0, std::uint32_t y0,
+                              std::uint32_t x1, std::uint32_t y1, std::uint64_t & result )
+    {
+        const std::uint64_t zmin = encode( x0, y0, level );
+        const std::uint64_t zmax = encode( x1, y1, level );
+
+        if ( z > zmax ) return false;
+
+        std::uint32_t x, y;
+        decode( z, level, x, y );
+
+        if ( z <= zmin )
+            result = zmin;
+        else if ( x >= x0 && x <= x1 && y >= y0 && y <= y1 )
+            result = z;
+        else
+            result = detail::bigmin( z, zmin, zmax, 2 * level );
+
+        return true;
+    }
+
+    static std::uint64_t cell_key( double dx, double dy, double width, double height, int depth )
+    {
+        return detail::cell_key( dx, dy, width, height, depth );
+    }
+
+    static void cell_keys( const double * dx, const double * dy, std::size_t n,
+                           double width, double height, int depth, std::uint64_t * keys )
+    {
+        detail::cell_keys( dx, dy, n, width, height, depth, keys );
+    }
+};
+
+#endif // QUADTREE_MORTON_H
@@ -0,0 +1,103 @@
+#ifndef QUADTREE_NEAREST_SEARCH_H
+#define QUADTREE_NEAREST_SEARCH_H
+
+#include "small_containers.h"
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * @brief nearest_search
+     *
+     * A best-first search for the k objects nearest a point, shared by
+     * quad_tree and orth_tree: the nodes yet to be searched, nearest first,
+     * and in found the nearest objects seen so far, as ( squared distance,
+     * object ) with the furthest on top. A tree pops each node with next(),
+     * and offers its objects and its children along with their distances;
+     * the search ends once no node left could hold an object nearer than
+     * the k-th found.
+     */
+    template< typename T, typename Node_handle, typename Found_type >
+    class nearest_search
+    {
+    public:
+
+        nearest_search( Found_type & found, std::size_t k, Node_handle root )
+
+            : m_found( found )
+            , m_k( k )
+        {
+            // objects reaching beyond a tree's bounds are held by its root,
+            // so it is searched however far the point is from it
+            m_open.push( entry_type( 0.0, root ));
+        }
+
+        bool next( Node_handle & h )
+        {
+            if ( m_open.empty() || ( m_found.size() >= m_k && m_open.top().first >= m_found.top().first ))
+                return false;
+
+            h = m_open.top().second;
+            m_open.pop();
+
+            return true;
+        }
+
+        void offer( double d, const T & obj )
+        {
+            if ( m_found.size() < m_k )
+            {
+                m_found.push( std::make_pair( d, &obj ));
+            }
+            else if ( d < m_found.top().first )
+            {
+                m_found.pop();
+                m_found.push( std::make_pair( d, &obj ));
+            }
+        }
+
+        void offer_node( double d, Node_handle h )
+        {
+            if ( m_found.size() < m_k || d < m_found.top().first )
+                m_open.push( entry_type( d, h ));
+        }
+
+    private:
+
+        typedef std::pair< double, Node_handle > entry_type;
+
+        small_priority_queue< entry_type, 64, std::greater< entry_type > > m_open;
+        Found_type &    m_found;
+        std::size_t     m_k;
+    };
+
+    /**
+     * @brief sink_nearest_first
+     *
+     * Empties found, as left by nearest_search (the furthest on top), into
+     * sink, nearest first.
+     */
+    template< typename T, typename Found_type, typename Functor_type >
+    void sink_nearest_first( Found_type & found, const Functor_type & sink )
+    {
+        small_stack< const T *, 64 > nearest_first;
+
+        for ( ; !found.empty(); found.pop() )
+        {
+            nearest_first.push( found.top().second );
+        }
+
+        while ( !nearest_first.empty() )
+        {
+            sink( *nearest_first.pop() );
+        }
+    }
+}
+
+#endif // QUADTREE_NEAREST_SEARCH_H
@@ -0,0 +1,347 @@
+#ifndef QUADTREE_OBJECT_BUCKET_H
+#define QUADTREE_OBJECT_BUCKET_H
+
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#if defined( __AVX__ )
+#include <immintrin.h>
+#endif
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * An axis-aligned box given by its minimum and maximum corners.
+     */
+    template< typename Data_type >
+    struct box
+    {
+        Data_type   min_x;
+        Data_type   min_y;
+        Data_type   max_x;
+        Data_type   max_y;
+    };
+
+    /**
+     * @brief overlap_mask
+     *
+     * Tests a block of 4 boxes, held as 4 min x, 4 min y, 4 max x and then
+     * 4 max y values, against a query box (closed intervals).
+     *
+     * @return A bitmask with bit i set if box i of the block overlaps the query.
+     */
+    template< typename Data_type >
+    struct overlap_mask
+    {
+        int operator()( const Data_type * block, const box< Data_type > & q ) const
+        {
+            int mask = 0;
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                // bitwise rather than logical and, so the test does not branch
+                int overlap = ( block[ i ] <= q.max_x ) & ( block[ 4 + i ] <= q.max_y ) &
+                              ( block[ 8 + i ] >= q.min_x ) & ( block[ 12 + i ] >= q.min_y );
+
+                mask |= overlap << i;
+            }
+
+            return mask;
+        }
+    };
+
+#if defined( __SSE2__ )
+
+    template<>
+    struct overlap_mask< int >
+    {
+        int operator()( const int * block, const box< int > & q ) const
+        {
+            __m128i min_x = _mm_loadu_si128( reinterpret_cast< const __m128i * >( block ));
+            __m128i min_y = _mm_loadu_si128( reinterpret_cast< const __m128i * >( block + 4 ));
+            __m128i max_x = _mm_loadu_si128( reinterpret_cast< const __m128i * >( block + 8 ));
+            __m128i max_y = _mm_loadu_si128( reinterpret_cast< const __m128i * >( block + 12 ));
+
+            // a box misses if it starts beyond the query, or ends before it
+            __m128i miss = _mm_or_si128( _mm_or_si128( _mm_cmpgt_epi32( min_x, _mm_set1_epi32( q.max_x )),
+                                                       _mm_cmpgt_epi32( min_y, _mm_set1_epi32( q.max_y ))),
+                                         _mm_or_si128( _mm_cmplt_epi32( max_x, _mm_set1_epi32( q.min_x )),
+                                                       _mm_cmplt_epi32( max_y, _mm_set1_epi32( q.min_y ))));
+
+            return ~_mm_movemask_ps( _mm_castsi128_ps( miss )) & 0xf;
+        }
+    };
+
+    template<>
+    struct overlap_mask< float >
+    {
+        int operator()( const float * block, const box< float > & q ) const
+        {
+            __m128 hit = _mm_and_ps( _mm_and_ps( _mm_cmple_ps( _mm_loadu_ps( block ), _mm_set1_ps( q.max_x )),
+                                                 _mm_cmple_ps( _mm_loadu_ps( block + 4 ), _mm_set1_ps( q.max_y ))),
+                                     _mm_and_ps( _mm_cmpge_ps( _mm_loadu_ps( block + 8 ), _mm_set1_ps( q.min_x )),
+                                                 _mm_cmpge_ps( _mm_loadu_ps( block + 12 ), _mm_set1_ps( q.min_y ))));
+
+            return _mm_movemask_ps( hit );
+        }
+    };
+
+#endif
+
+#if defined( __SSE2__ ) && !defined( __AVX__ )
+
+    template<>
+    struct overlap_mask< double >
+    {
+        int operator()( const double * block, const box< double > & q ) const
+        {
+            return half( block, q ) | ( half( block + 2, q ) << 2 );
+        }
+
+    private:
+
+        static int half( const double * block, const box< double > & q )
+        {
+            __m128d hit = _mm_and_pd( _mm_and_pd( _mm_cmple_pd( _mm_loadu_pd( block ), _mm_set1_pd( q.max_x )),
+                                                  _mm_cmple_pd( _mm_loadu_pd( block + 4 ), _mm_set1_pd( q.max_y ))),
+                                      _mm_and_pd( _mm_cmpge_pd( _mm_loadu_pd( block + 8 ), _mm_set1_pd( q.min_x )),
+                                                  _mm_cmpge_pd( _mm_loadu_pd( block + 12 ), _mm_set1_pd( q.min_y ))));
+
+            return _mm_movemask_pd( hit );
+        }
+    };
+
+#endif
+
+#if defined( __AVX__ )
+
+    template<>
+    struct overlap_mask< double >
+    {
+        int operator()( const double * block, const box< double > & q ) const
+        {
+            __m256d hit = _mm256_and_pd( _mm256_and_pd( _mm256_cmp_pd( _mm256_loadu_pd( block ), _mm256_set1_pd( q.max_x ), _CMP_LE_OQ ),
+                                                        _mm256_cmp_pd( _mm256_loadu_pd( block + 4 ), _mm256_set1_pd( q.max_y ), _CMP_LE_OQ )),
+                                         _mm256_and_pd( _mm256_cmp_pd( _mm256_loadu_pd( block + 8 ), _mm256_set1_pd( q.min_x ), _CMP_GE_OQ ),
+                                                        _mm256_cmp_pd( _mm256_loadu_pd( block + 12 ), _mm256_set1_pd( q.min_y ), _CMP_GE_OQ )));
+
+            return _mm256_movemask_pd( hit );
+        }
+    };
+
+#endif
+
+    /**
+     * @brief object_bucket
+     *
+     * The objects held by a single quad node. Alongside the objects, the
+     * bucket keeps a copy of their bounding boxes in blocks of 4, each block
+     * holding 4 min x, 4 min y, 4 max x and 4 max y values, so that a query
+     * box can be tested against 4 objects at a time. The unused lanes of the
+     * last block hold an empty box, and are masked off by the queries.
+     *
+     * Box_function is a function object giving the detail::box of a T.
+     */
+    template< typename T, typename Data_type, typename Box_function >
+    class object_bucket
+    {
+    public:
+
+        typedef std::vector< T >                            container_type;
+        typedef typename container_type::const_iterator     const_iterator;
+        typedef typename container_type::size_type          size_type;
+        typedef box< Data_type >                            box_type;
+
+        enum { lanes = 4, block_size = 4 * lanes };
+
+        const_iterator begin() const                { return m_objects.begin(); }
+        const_iterator end() const                  { return m_objects.end(); }
+        size_type size() const                      { return m_objects.size(); }
+        bool empty() const                          { return m_objects.empty(); }
+        size_type capacity() const                  { return m_objects.capacity(); }
+        const T & operator[]( size_type i ) const   { return m_objects[ i ]; }
+
+        void reserve( size_type n )
+        {
+            m_objects.reserve( n );
+            m_boxes.reserve( blocks( n ) * block_size );
+        }
+
+        void push_back( const T & v )
+        {
+            if ( m_objects.size() % lanes == 0 )
+            {
+                append_block();
+            }
+
+            m_objects.push_back( v );
+            store( m_objects.size() - 1, Box_function()( v ));
+        }
+
+        template< typename Input_iterator >
+        void assign( Input_iterator first, Input_iterator last )
+        {
+            clear();
+            reserve( std::distance( first, last ));
+
+            for ( ; first != last; ++first )
+            {
+                push_back( *first );
+            }
+        }
+
+        /**
+         * Replaces the object at i.
+         */
+        void set( size_type i, const T & v )
+        {
+            m_objects[ i ] = v;
+            store( i, Box_function()( v ));
+        }
+
+        /**
+         * Removes the object at i, moving the last object into its place.
+         */
+        void erase( size_type i )
+        {
+            const size_type last = m_objects.size() - 1;
+
+            if ( i != last )
+                set( i, m_objects[ last ] );
+
+            truncate( last );
+        }
+
+        /**
+         * Removes every object from n onwards.
+         */
+        void truncate( size_type n )
+        {
+            m_objects.erase( m_objects.begin() + n, m_objects.end() );
+            m_boxes.resize( blocks( n ) * block_size );
+
+            for ( size_type i = n; i % lanes != 0; ++i )
+            {
+                store( i, empty_box() );
+            }
+        }
+
+        void clear()
+        {
+            m_objects.clear();
+            m_boxes.clear();
+        }
+
+        void swap( object_bucket & other )
+        {
+            m_objects.swap( other.m_objects );
+            m_boxes.swap( other.m_boxes );
+        }
+
+        /**
+         * Calls f for each held object whose bounding box overlaps q.
+         */
+        template< typename Functor_type >
+        void for_each_overlap( const box_type & q, const Functor_type & f ) const
+        {
+            const Data_type * block = m_boxes.data();
+
+            for ( size_type b = 0; b < m_objects.size(); b += lanes, block += block_size )
+            {
+                int mask = overlap_mask< Data_type >()( block, q ) & lane_mask( b );
+
+                for ( int i = 0; mask; ++i, mask >>= 1 )
+                {
+                    if ( mask & 1 )
+                        f( m_objects[ b + i ] );
+                }
+            }
+        }
+
+        /**
+         * The position of the first held object whose bounding box overlaps
+         * q and for which pred holds, or size() if there is none.
+         */
+        template< typename Predicate >
+        size_type find_if( const box_type & q, const Predicate & pred ) const
+        {
+            const Data_type * block = m_boxes.data();
+
+            for ( size_type b = 0; b < m_objects.size(); b += lanes, block += block_size )
+            {
+                int mask = overlap_mask< Data_type >()( block, q ) & lane_mask( b );
+
+                for ( int i = 0; mask; ++i, mask >>= 1 )
+                {
+                    if ( ( mask & 1 ) && pred( m_objects[ b + i ] ))
+                        return b + i;
+                }
+            }
+
+            return m_objects.size();
+        }
+
+    private:
+
+        static size_type blocks( size_type n )
+        {
+            return ( n + lanes - 1 ) / lanes;
+        }
+
+        /**
+         * The lanes of the block starting at object b that hold objects:
+         * the empty box in the others is overlapped by a query as wide as
+         * the type itself (lowest to max, or infinite).
+         */
+        int lane_mask( size_type b ) const
+        {
+            const size_type n = m_objects.size() - b;
+
+            return n < lanes ? ( 1 << n ) - 1 : ( 1 << lanes ) - 1;
+        }
+
+        static box_type empty_box()
+        {
+            box_type b = { std::numeric_limits< Data_type >::max(), std::numeric_limits< Data_type >::max(),
+                           std::numeric_limits< Data_type >::lowest(), std::numeric_limits< Data_type >::lowest() };
+            return b;
+        }
+
+        void append_block()
+        {
+            const box_type e = empty_box();
+
+            m_boxes.insert( m_boxes.end(), lanes, e.min_x );
+            m_boxes.insert( m_boxes.end(), lanes, e.min_y );
+            m_boxes.insert( m_boxes.end(), lanes, e.max_x );
+            m_boxes.insert( m_boxes.end(), lanes, e.max_y );
+        }
+
+        void store( size_type i, const box_type & b )
+        {
+            Data_type * block = &m_boxes[ ( i / lanes ) * block_size ];
+            const size_type lane = i % lanes;
+
+            block[ lane ] = b.min_x;
+            block[ lanes + lane ] = b.min_y;
+            block[ 2 * lanes + lane ] = b.max_x;
+            block[ 3 * lanes + lane ] = b.max_y;
+        }
+
+    private:
+
+        container_type              m_objects;
+        std::vector< Data_type >    m_boxes;
+    };
+}
+
+#endif // QUADTREE_OBJECT_BUCKET_H
@@ -0,0 +1,798 @@
+#ifndef QUADTREE_ORTHTREE_H
+#define QUADTREE_ORTHTREE_H
+
+#include "../vector/vector.h"
+#include "bulk_load.h"
+#include "geom.h"
+#include "nearest_search.h"
+#include "quadtree.h"
+#include "small_containers.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * The point type of each dimension, from vector.h.
+     */
+    template< int Dimension, typename Data_type >
+    struct orth_point;
+
+    template< typename Data_type >
+    struct orth_point< 2, Data_type >
+    {
+        typedef vector_2d< Data_type >  type;
+    };
+
+    template< typename Data_type >
+    struct orth_point< 3, Data_type >
+    {
+        typedef vector_3d< Data_type >  type;
+    };
+
+    /**
+     * An axis-aligned box of any dimension, given by its minimum and maximum
+     * corners (closed intervals), indexed by axis.
+     */
+    template< int Dimension, typename Data_type >
+    struct orth_box
+    {
+        Data_type   min[ Dimension ];
+        Data_type   max[ Dimension ];
+    };
+
+    /**
+     * @brief orth_bounding_box
+     *
+     * The bounding box of a point (x(), y() and, in 3d, z()) or of a box
+     * (with width(), height() and, in 3d, depth() too), as an orth_box.
+     * Specialised for each dimension, so that the coordinates are read
+     * by name and the tree's loops over axes have a constant trip count.
+     */
+    template< int Dimension, int Kind, typename Data_type >
+    struct orth_bounding_box;
+
+    template< typename Data_type >
+    struct orth_bounding_box< 2, POINT_TYPE, Data_type >
+    {
+        template< typename Point_type >
+        orth_box< 2, Data_type > operator()( const Point_type & p ) const
+        {
+            orth_box< 2, Data_type > b = { { p.x(), p.y() }, { p.x(), p.y() } };
+            return b;
+        }
+    };
+
+    template< typename Data_type >
+    struct orth_bounding_box< 2, RECTANGLE_TYPE, Data_type >
+    {
+        template< typename Rect_type >
+        orth_box< 2, Data_type > operator()( const Rect_type & r ) const
+        {
+            orth_box< 2, Data_type > b = { { r.x(), r.y() }, { r.x() + r.width(), r.y() + r.height() } };
+            return b;
+        }
+    };
+
+    template< typename Data_type >
+    struct orth_bounding_box< 3, POINT_TYPE, Data_type >
+    {
+        template< typename Point_type >
+        orth_box< 3, Data_type > operator()( const Point_type & p ) const
+        {
+            orth_box< 3, Data_type > b = { { p.x(), p.y(), p.z() }, { p.x(), p.y(), p.z() } };
+            return b;
+        }
+    };
+
+    template< typename Data_type >
+    struct orth_bounding_box< 3, RECTANGLE_TYPE, Data_type >
+    {
+        template< typename Box_type >
+        orth_box< 3, Data_type > operator()( const Box_type & r ) const
+        {
+            orth_box< 3, Data_type > b = { { r.x(), r.y(), r.z() }, { r.x() + r.width(), r.y() + r.height(), r.z() + r.depth() } };
+            return b;
+        }
+    };
+}
+
+/**
+ * A line segment of any dimension, defined by two endpoints.
+ */
+template< typename Point_type >
+class orth_segment
+{
+public:
+
+    typedef Point_type              point_type;
+
+    orth_segment( const point_type & p1, const point_type & p2 )
+
+        : m_p1( p1 )
+        , m_p2( p2 )
+    {}
+
+    const point_type &  p1() const  { return m_p1; }
+    const point_type &  p2() const  { return m_p2; }
+
+private:
+
+    point_type  m_p1;
+    point_type  m_p2;
+};
+
+/**
+ *
+ * orth_tree is quad_tree generalised over its dimension: each node splits
+ * into 2^Dimension children about its midpoint, 4 (a quad tree) in 2d and
+ * 8 (an octree) in 3d. T is the type of object held; in 3d either a point,
+ * with x(), y() and z(), or a box, with width(), height() and depth() too.
+ *
+ * Objects are placed exactly as quad_tree places them: in the deepest node
+ * of whose children none holds them whole, with those reaching beyond the
+ * tree's bounds held by the root. In 2d the tree has the same nodes, holding
+ * the same objects, as a quad_tree given the same objects.
+ *
+ * Nodes are held in a single pool owned by the tree, the children of a node
+ * in one block, numbered with bit a set for the upper half along axis a. The
+ * dimension is a template parameter, so every loop over the axes or children
+ * has a constant trip count and the coordinates of objects are read through
+ * specialisations for each dimension: nothing is decided at run time which
+ * a quad_tree would not decide.
+ *
+ * orth_tree is a separate implementation from quad_tree, which keeps its
+ * own nodes for the sake of its many queries and formats; the two share
+ * the steps of a bulk load (bulk_load.h) and the best-first search of
+ * nearest() (nearest_search.h).
+ *
+ */
+template< int Dimension, typename T >
+class orth_tree
+{
+    static_assert( Dimension == 2 || Dimension == 3, "orth_tree supports 2 or 3 dimensions" );
+
+    static const int npos = detail::npos;
+
+    enum { child_count = 1 << Dimension };
+
+    typedef typename std::decay< decltype(((T*)nullptr)->x()) >::type point_data_type;
+    typedef int                                         node_handle;
+    typedef std::vector< T >                            container_type;
+    typedef detail::orth_bounding_box< Dimension, detail::has_width_member< T >::value, point_data_type > box_function;
+
+public:
+
+    typedef T                                           value_type;
+    typedef typename detail::orth_point< Dimension, point_data_type >::type point_type;
+    typedef detail::orth_box< Dimension, point_data_type > box_type;
+    typedef orth_segment< point_type >                  line_type;
+    typedef unsigned                                    size_type;
+
+    enum { dimension = Dimension };
+
+    orth_tree( const box_type & bounds, int max_levels, int max_objects )
+
+        : m_max_levels( max_levels )
+        , m_max_objects( max_objects )
+    {
+        point_data_type size[ Dimension ];
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            size[ a ] = bounds.max[ a ] - bounds.min[ a ];
+        }
+
+        m_nodes.push_back( node( bounds.min, size, 0 ));
+    }
+
+    /**
+     * @brief Bulk-load constructor
+     *
+     * Builds the tree from the objects in [first, last), as quad_tree's
+     * bulk-load constructor: the objects are sorted once by the cell key of
+     * their centre, after which each node is built in a single top-down
+     * pass over its contiguous run of them. The resulting tree holds the
+     * same objects in the same nodes as one built by calling insert() for
+     * every object.
+     */
+    template< typename Input_iterator >
+    orth_tree( const box_type & bounds, int max_levels, int max_objects,
+               Input_iterator first, Input_iterator last )
+
+        : orth_tree( bounds, max_levels, max_objects )
+    {
+        container_type staged( first, last );
+        key_array keys( staged.size() );
+
+        m_nodes.reserve( 1 + child_count * ( staged.size() / ( m_max_objects + 1 )));
+
+        build( root, staged, keys, 0, staged.size(), 0, 0 );
+    }
+
+    orth_tree( const orth_tree & ) = delete;
+    orth_tree & operator=( const orth_tree & ) = delete;
+
+    box_type bounds() const
+    {
+        return node_box( m_nodes[ root ] );
+    }
+
+    /**
+     * @brief size
+     * @return the number of objects held.
+     */
+    size_type size() const
+    {
+        size_type sz = 0;
+
+        for ( const node & n : m_nodes )
+
+            sz += n.objects.size();
+
+        return sz;
+    }
+
+    /**
+     * @brief node_count
+     * @return the number of nodes in the pool.
+     */
+    size_type node_count() const
+    {
+        return m_nodes.size();
+    }
+
+    /**
+     *
+     * @brief insert
+     *
+     * Insert an object into the correct node of the tree.
+     *
+     */
+    void insert( const value_type & v )
+    {
+        insert( root, v );
+    }
+
+    /**
+     * @brief for_each_match
+     *
+     * Calls f for every object held by the nodes which the box r reaches,
+     * as quad_tree::for_each_match.
+     */
+    template< typename Functor_type >
+    void for_each_match( const box_type & r, const Functor_type & f ) const
+    {
+        for_each_match( root, r, f );
+    }
+
+    /**
+     * As above, for the bounding box of a point or box (as for value_type).
+     */
+    template< typename Object_type, typename Functor_type >
+    void for_each_match( const Object_type & r, const Functor_type & f ) const
+    {
+        for_each_match( root, detail::orth_bounding_box< Dimension, detail::has_width_member< Object_type >::value, point_data_type >()( r ), f );
+    }
+
+    /**
+     * @brief line_intersect
+     *
+     * Calls f for every object held by the nodes which the segment l (any
+     * type with p1() and p2() points) passes through, nearest to p1 first,
+     * as quad_tree::line_intersect.
+     */
+    template< typename Segment_type, typename Functor_type >
+    void line_intersect( const Segment_type & l, const Functor_type & f ) const
+    {
+        const segment s = make_segment( l.p1(), l.p2() );
+
+        line_intersect( root, s, f );
+    }
+
+    /**
+     * @brief nearest
+     *
+     * Finds the k objects nearest to p, measured to the nearest point of
+     * their bounding boxes, and passes them to sink nearest first, searching
+     * nodes best-first as quad_tree::nearest.
+     */
+    template< typename Functor_type >
+    void nearest( const point_type & p, size_type k, const Functor_type & sink ) const
+    {
+        typedef std::pair< double, const T * > candidate_type;
+
+        if ( k == 0 ) return;
+
+        double at[ Dimension ];
+        const box_type b = detail::orth_bounding_box< Dimension, detail::POINT_TYPE, point_data_type >()( p );
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            at[ a ] = double( b.min[ a ] );
+        }
+
+        detail::small_priority_queue< candidate_type, 64 > found;
+        best_first_nearest( at, k, found );
+
+        detail::sink_nearest_first< T >( found, sink );
+    }
+
+private:
+
+    enum { root = 0 };
+
+    /**
+     * A single node. Its bounds are held as quad_tree's rectangle holds
+     * them, as an origin and a size, so that halving them truncates exactly
+     * as quad_tree's do. The children of a node (if any) are held in the
+     * pool at [first_child, first_child + child_count).
+     */
+    struct node
+    {
+        node( const point_data_type * o, const point_data_type * s, size_type l )
+
+            : level( l )
+            , first_child( npos )
+        {
+            std::copy( o, o + Dimension, origin );
+            std::copy( s, s + Dimension, size );
+        }
+
+        point_data_type         origin[ Dimension ];
+        point_data_type         size[ Dimension ];
+        size_type               level;
+        node_handle             first_child;
+        container_type          objects;
+    };
+
+    typedef std::vector< node >                         node_pool;
+
+    // a segment as its start and its extent along each axis
+    struct segment
+    {
+        double      start[ Dimension ];
+        double      delta[ Dimension ];
+        int         direction;      // bit a set if the segment runs down axis a
+    };
+
+    template< typename Point_type >
+    static segment make_segment( const Point_type & p1, const Point_type & p2 )
+    {
+        typedef detail::orth_bounding_box< Dimension, detail::POINT_TYPE, point_data_type > point_box;
+
+        const box_type b1 = point_box()( p1 );
+        const box_type b2 = point_box()( p2 );
+
+        segment s;
+        s.direction = 0;
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            s.start[ a ] = double( b1.min[ a ] );
+            s.delta[ a ] = double( b2.min[ a ] ) - s.start[ a ];
+
+            if ( b2.min[ a ] < b1.min[ a ] ) s.direction |= 1 << a;
+        }
+
+        return s;
+    }
+
+    static box_type node_box( const node & n )
+    {
+        box_type b;
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            b.min[ a ] = n.origin[ a ];
+            b.max[ a ] = n.origin[ a ] + n.size[ a ];
+        }
+
+        return b;
+    }
+
+    // the children with bit a set, that is those in the upper half along
+    // axis a, for each axis
+    static int upper_children( int a )
+    {
+        static const int masks[ 3 ] = { 0xAA, 0xCC, 0xF0 };
+
+        return masks[ a ] & (( 1 << child_count ) - 1 );
+    }
+
+    /**
+     * The child of n which holds the box b whole, or npos if b straddles a
+     * midplane of n, as detail::index: a box lies in the lower half along an
+     * axis if it ends below the midpoint, in the upper if it starts at or
+     * above it.
+     */
+    int index( const node & n, const box_type & b ) const
+    {
+        // objects reaching beyond the tree's bounds are held by the root,
+        // as for quad_tree
+        if ( n.level == 0 && !within( n, b )) return npos;
+
+        int result = 0;
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            const point_data_type mid = n.origin[ a ] + n.size[ a ] / 2;
+
+            if ( b.min[ a ] >= mid )
+                result |= 1 << a;
+            else if ( !( b.max[ a ] < mid ))
+                return npos;
+        }
+
+        return result;
+    }
+
+    static bool within( const node & n, const box_type & b )
+    {
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            if ( b.min[ a ] < n.origin[ a ] || b.max[ a ] > n.origin[ a ] + n.size[ a ] ) return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * The children of n (which has some) which the box r reaches, as a
+     * bitmask, as detail::intersects gives them from r's corners.
+     */
+    static int intersects( const node & n, const box_type & r )
+    {
+        int result = ( 1 << child_count ) - 1;
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            const point_data_type mid = n.origin[ a ] + n.size[ a ] / 2;
+
+            if ( !( r.min[ a ] < mid ))  result &= upper_children( a );
+            if ( !( r.max[ a ] >= mid )) result &= ~upper_children( a );
+        }
+
+        return result;
+    }
+
+    /**
+     * Whether the segment s touches the closed bounds of n.
+     */
+    static bool touches( const node & n, const segment & s )
+    {
+        double t0 = 0.0;
+        double t1 = 1.0;
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            if ( !clip_slab( -s.delta[ a ], s.start[ a ] - n.origin[ a ], t0, t1 ) ||
+                 !clip_slab( s.delta[ a ], double( n.origin[ a ] ) + n.size[ a ] - s.start[ a ], t0, t1 ))
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * The squared distance from the point at to the box b, or to the bounds
+     * of n, grown (with integral coordinates) by a unit per level, as
+     * quad_tree::object_bounds grows them, for the truncated halving of odd
+     * sizes.
+     */
+    static double squared_distance( const double * at, const box_type & b )
+    {
+        double d2 = 0.0;
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            const double d = std::max( std::max( double( b.min[ a ] ) - at[ a ], at[ a ] - double( b.max[ a ] )), 0.0 );
+
+            d2 += d * d;
+        }
+
+        return d2;
+    }
+
+    static double squared_distance( const double * at, const node & n )
+    {
+        box_type b = node_box( n );
+
+        if ( std::is_integral< point_data_type >::value )
+        {
+            for ( int a = 0; a < Dimension; ++a )
+            {
+                b.max[ a ] += point_data_type( n.level );
+            }
+        }
+
+        return squared_distance( at, b );
+    }
+
+    template< typename Functor_type >
+    void for_each_match( node_handle h, const box_type & r, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( n.first_child != npos )
+        {
+            const int indices = intersects( n, r );
+
+            for ( int i = 0; i < child_count; ++i )
+            {
+                if ( indices & (1<<i) )
+                {
+                    for_each_match( n.first_child + i, r, f );
+                }
+            }
+        }
+
+        for ( const T & obj : n.objects )
+        {
+            f( obj );
+        }
+    }
+
+    template< typename Functor_type >
+    void line_intersect( node_handle h, const segment & s, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( touches( n, s ))
+        {
+            // a segment only ever moves from the lower half to the upper
+            // along an axis it runs up, so ascending order of the children,
+            // with the axes it runs down reversed, is nearest first
+            if ( n.first_child != npos )
+            {
+                for ( int i = 0; i < child_count; ++i )
+                {
+                    line_intersect( n.first_child + ( i ^ s.direction ), s, f );
+                }
+            }
+
+            for ( const T & obj : n.objects )
+            {
+                f( obj );
+            }
+        }
+    }
+
+    /**
+     * Leaves in found the k objects nearest to at (or all of them, if
+     * there are fewer), as ( squared distance, object ) with the furthest
+     * on top.
+     */
+    template< typename Queue_type >
+    void best_first_nearest( const double * at, size_type k, Queue_type & found ) const
+    {
+        detail::nearest_search< T, node_handle, Queue_type > search( found, k, root );
+        node_handle h;
+
+        while ( search.next( h ))
+        {
+            const node & n = m_nodes[ h ];
+
+            for ( const T & obj : n.objects )
+            {
+                search.offer( squared_distance( at, box_function()( obj )), obj );
+            }
+
+            if ( n.first_child != npos )
+            {
+                for ( int i = 0; i < child_count; ++i )
+                {
+                    search.offer_node( squared_distance( at, m_nodes[ n.first_child + i ] ), n.first_child + i );
+                }
+            }
+        }
+    }
+
+    // the children of h, appended to the pool as one block
+    void split( node_handle h )
+    {
+        const node & n = m_nodes[ h ];
+        const size_type level = n.level + 1;
+
+        point_data_type origin[ Dimension ], half[ Dimension ];
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            half[ a ] = n.size[ a ] / 2;
+        }
+
+        const node_handle first = m_nodes.size();
+        const point_data_type * base = n.origin;
+        point_data_type parent_origin[ Dimension ];
+
+        std::copy( base, base + Dimension, parent_origin );
+
+        for ( int i = 0; i < child_count; ++i )
+        {
+            for ( int a = 0; a < Dimension; ++a )
+            {
+                origin[ a ] = parent_origin[ a ] + ( i & ( 1 << a ) ? half[ a ] : 0 );
+            }
+
+            // may reallocate the pool, so n is not used beyond here
+            m_nodes.push_back( node( origin, half, level ));
+        }
+
+        m_nodes[ h ].first_child = first;
+    }
+
+    void insert( node_handle h, const value_type & v )
+    {
+        const box_type b = box_function()( v );
+
+        while ( m_nodes[ h ].first_child != npos )
+        {
+            const int idx = index( m_nodes[ h ], b );
+
+            if ( idx == npos ) break;
+
+            h = m_nodes[ h ].first_child + idx;
+        }
+
+        container_type & target = m_nodes[ h ].objects;
+
+        // as quad_tree, a node holds at most m_max_objects + 1 before it splits
+        if ( target.capacity() == 0 )
+            target.reserve( m_max_objects + 1 );
+
+        target.push_back( v );
+
+        if ( m_nodes[ h ].first_child == npos && target.size() > size_type( m_max_objects ) && m_nodes[ h ].level < size_type( m_max_levels ))
+        {
+            split( h );
+
+            // the pool may grow while pushing objects down, so the node is
+            // always re-fetched through its handle
+            size_type kept = 0;
+
+            for ( size_type i = 0; i < m_nodes[ h ].objects.size(); ++i )
+            {
+                const value_type obj = m_nodes[ h ].objects[ i ];
+                const int idx = index( m_nodes[ h ], box_function()( obj ));
+
+                if ( idx != npos )
+                {
+                    insert( m_nodes[ h ].first_child + idx, obj );
+                }
+                else
+                {
+                    if ( kept != i )
+                        m_nodes[ h ].objects[ kept ] = obj;
+                    ++kept;
+                }
+            }
+
+            m_nodes[ h ].objects.erase( m_nodes[ h ].objects.begin() + kept, m_nodes[ h ].objects.end() );
+        }
+    }
+
+    // bulk loading
+
+    typedef detail::bulk_key_array                      key_array;
+
+    // number of levels which fit into a single 64 bit cell key
+    enum { max_key_levels = 63 / Dimension };
+
+    /**
+     * The cell key of an object's centre, relative to the node n: Dimension
+     * bits (the child index, as used by split()) per level, most significant
+     * first, so sorting by key groups the objects of every node's subtree
+     * into one contiguous run, as quad_tree::cell_key.
+     */
+    static std::uint64_t cell_key( const node & n, const value_type & obj, int levels )
+    {
+        const box_type b = box_function()( obj );
+
+        point_data_type centre[ Dimension ], origin[ Dimension ], size[ Dimension ];
+
+        for ( int a = 0; a < Dimension; ++a )
+        {
+            centre[ a ] = b.min[ a ] + ( b.max[ a ] - b.min[ a ] ) / 2;
+            origin[ a ] = n.origin[ a ];
+            size[ a ] = n.size[ a ];
+        }
+
+        std::uint64_t key = 0;
+
+        for ( int i = 0; i < levels; ++i )
+        {
+            int child = 0;
+
+            for ( int a = 0; a < Dimension; ++a )
+            {
+                size[ a ] = size[ a ] / 2;
+
+                const int upper = centre[ a ] >= origin[ a ] + size[ a ];
+
+                origin[ a ] += upper * size[ a ];
+                child |= upper << a;
+            }
+
+            key = ( key << Dimension ) | std::uint64_t( child );
+        }
+
+        return key;
+    }
+
+    /**
+     * Computes the keys of the run [b, e) relative to node n, and reorders
+     * both the keys and the objects of the run into key order (ties in
+     * their current order).
+     */
+    static void sort_run( const node & n, container_type & objects, key_array & keys, size_type b, size_type e, int key_levels )
+    {
+        detail::sort_run( objects, keys, b, e, Dimension * key_levels,
+            [&n, key_levels]( const T & obj ) { return cell_key( n, obj, key_levels ); } );
+    }
+
+    /**
+     * Builds the subtree rooted at h from the run [b, e) of the staged
+     * objects and their keys, as quad_tree::build: key_level is the level
+     * (relative to the last keying) at which the child is read from a key,
+     * key_levels the number of levels the current keys hold.
+     */
+    void build( node_handle h, container_type & objects, key_array & keys, size_type b, size_type e, int key_level, int key_levels )
+    {
+        if ( e - b <= size_type( m_max_objects ) || m_nodes[ h ].level >= size_type( m_max_levels ))
+        {
+            m_nodes[ h ].objects.assign( objects.begin() + b, objects.begin() + e );
+            return;
+        }
+
+        if ( key_level == key_levels )
+        {
+            key_level = 0;
+            key_levels = std::min< int >( max_key_levels, m_max_levels - m_nodes[ h ].level );
+
+            sort_run( m_nodes[ h ], objects, keys, b, e, key_levels );
+        }
+
+        split( h );
+
+        // objects which straddle a midplane stay here, the rest keep their
+        // (sorted) order and are handed down to the children
+        node & n = m_nodes[ h ];
+
+        const size_type kept = detail::hand_down( objects, keys, b, e,
+            [this, &n]( const T & obj ) { return index( n, box_function()( obj )) == npos; },
+            [&n]( const T & obj ) { n.objects.push_back( obj ); } );
+
+        const int shift = Dimension * ( key_levels - key_level - 1 );
+        const node_handle first_child = n.first_child;
+
+        for ( int i = 0; i < child_count; ++i )
+        {
+            const size_type child_end = detail::child_run_end( keys, b, kept, shift, Dimension, i );
+
+            build( first_child + i, objects, keys, b, child_end, key_level + 1, key_levels );
+
+            b = child_end;
+        }
+    }
+
+    const int   m_max_levels;
+    const int   m_max_objects;
+    node_pool   m_nodes;
+};
+
+/**
+ * An octree: orth_tree in 3d.
+ */
+template< typename T >
+using oct_tree = orth_tree< 3, T >;
+
+#endif // QUADTREE_ORTHTREE_H
@@ -0,0 +1,152 @@
+#ifndef QUADTREE_PARALLEL_H
+#define QUADTREE_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * @brief work_counter
+     *
+     * Hands out the indices [0, count) to any number of threads, in chunks
+     * of 'grain' consecutive indices, through a single atomic counter.
+     */
+    class work_counter
+    {
+    public:
+
+        work_counter( std::size_t count, std::size_t grain = 1 )
+
+            : m_next( 0 )
+            , m_count( count )
+            , m_grain( grain )
+        {
+        }
+
+        /**
+         * Claims the next chunk [b, e).
+         * @return false once every index has been handed out.
+         */
+        bool next( std::size_t & b, std::size_t & e )
+        {
+            b = m_next.fetch_add( m_grain );
+
+            if ( b >= m_count ) return false;
+
+            e = std::min( b + m_grain, m_count );
+
+            return true;
+        }
+
+    private:
+
+        std::atomic< std::size_t >  m_next;
+        std::size_t                 m_count;
+        std::size_t                 m_grain;
+    };
+
+    /**
+     * @brief run_workers
+     *
+     * Calls f( worker ) once on each of 'threads' threads, the calling
+     * thread being worker 0, and returns once all of them have finished.
+     */
+    template< typename Function >
+    void run_workers( unsigned threads, const Function & f )
+    {
+        std::vector< std::thread > workers;
+
+        for ( unsigned i = 1; i < threads; ++i )
+        {
+            workers.push_back( std::thread( f, i ));
+        }
+
+        f( 0u );
+
+        for ( std::thread & t : workers )
+        {
+            t.join();
+        }
+    }
+
+    /**
+     * @brief parallel_for
+     *
+     * Calls f( i ) for each i in [0, count), sharing the calls between up
+     * to 'threads' threads (including the calling thread). Workers take the
+     * next index from a shared counter, so uneven work balances itself.
+     */
+    template< typename Function >
+    void parallel_for( std::size_t count, unsigned threads, const Function & f )
+    {
+        work_counter counter( count );
+
+        run_workers( std::max( 1u, unsigned( std::min< std::size_t >( threads, count ))), [&]( unsigned )
+        {
+            std::size_t b, e;
+
+            while ( counter.next( b, e ))
+            {
+                f( b );
+            }
+        });
+    }
+
+    /**
+     * @brief run_batch
+     *
+     * Runs f( i, buffer ) for each i in [0, count), sharing the indices
+     * between up to 'threads' threads in chunks of 'grain'. Each worker has
+     * a buffer of its own, so f can append results without any locking.
+     *
+     * The buffers are cleared, not released, before use: passing the same
+     * buffers to successive batches reuses their storage.
+     */
+    template< typename Buffer_type, typename Function >
+    void run_batch( std::size_t count, unsigned threads, std::size_t grain, std::vector< Buffer_type > & buffers, const Function & f )
+    {
+        threads = std::max( 1u, unsigned( std::min< std::size_t >( threads, count )));
+
+        buffers.resize( threads );
+
+        work_counter counter( count, grain );
+
+        run_workers( threads, [&]( unsigned worker )
+        {
+            // filled locally, rather than in place, so that workers don't
+            // write to neighbouring buffer headers on every append
+            Buffer_type buffer;
+            buffer.swap( buffers[ worker ] );
+            buffer.clear();
+
+            std::size_t b, e;
+
+            while ( counter.next( b, e ))
+            {
+                for ( std::size_t i = b; i != e; ++i )
+                {
+                    f( i, buffer );
+                }
+            }
+
+            buffers[ worker ].swap( buffer );
+        });
+    }
+
+    /**
+     * The number of threads to use when the caller doesn't say.
+     */
+    inline unsigned default_thread_count()
+    {
+        return std::max( 1u, std::thread::hardware_concurrency() );
+    }
+}
+
+#endif // QUADTREE_PARALLEL_H
@@ -1,12 +1,29 @@
 #ifndef DYSON_N223_QUADTREE_H_INCLUDED
 #define DYSON_N223_QUADTREE_H_INCLUDED
 
+#include "bulk_load.h"
 #include "geom.h"
-
+#include "instrumentation.h"
+#include "nearest_search.h"
+#include "object_bucket.h"
+#include "parallel.h"
+#include "quadtree_image.h"
+#include "segment_packet.h"
+#include "small_containers.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
-#include <deque>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iterator>
-#include <memory>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -54,12 +71,37 @@ namespace detail
     template< int, typename >
     struct index;
 
+    template< int, typename >
+    struct centre;
+
+    template< int, typename >
+    struct bounding_box;
+
     template< int, typename >
     struct intersects;
 
     enum { POINT_TYPE, RECTANGLE_TYPE };
+
+    enum { npos = -1 };
 }
 
+/**
+ * The node policies of quad_tree: whether each node holds the objects lying
+ * within its bounds (tight_nodes), or those lying within its bounds grown
+ * by the tree's looseness about its centre (loose_nodes, for which see
+ * loose_quad_tree). The choice is made at compile time, so a tight tree's
+ * traversals do not test for looseness at every node.
+ */
+struct tight_nodes
+{
+    enum { loose = false };
+};
+
+struct loose_nodes
+{
+    enum { loose = true };
+};
+
 /**
  * quad_tree implementation
  *
@@ -69,47 +111,132 @@ namespace detail
  * may be represented as rectangles, with x(), y(), width() and height() member functions,
  * where those 4 functions define the axis-aligned bounding-box of a shape.
  *
+ * Nodes are held in a single flat pool owned by the tree and are referred to by
+ * integer handle. The four children of a node are always allocated as one contiguous
+ * block, so a node only records the handle of its first child. Node ids are not
+ * stored, they are derived from the position of a node within the pool on request.
+ *
+ * Queries report what they do to the Instrument policy (see instrumentation.h):
+ * the nodes they visit, the segment tests they make and the objects they emit.
+ * The default, no_instrumentation, does nothing, and costs nothing.
+ *
+ * Nodes is tight_nodes, or loose_nodes for a loose_quad_tree.
+ *
  */
-template< typename T >
+template< typename T, typename Instrument = no_instrumentation, typename Nodes = tight_nodes >
 class quad_tree
 {
-    static const int npos = -1;
+    static const int npos = detail::npos;
 
     typedef T                                           object_type;
-    typedef quad_tree< T >                              this_type;
-    typedef const quad_tree< T >*                       const_ptr;
+    typedef quad_tree< T, Instrument, Nodes >           this_type;
+    typedef detail::query_scope< Instrument >           query_scope;
     typedef std::vector< T >                            container_type;
     typedef typename container_type::iterator           iterator;
-    typedef std::unique_ptr< this_type >                unique_ptr;
     typedef decltype(((T*)nullptr)->x())                point_data_type;
+    typedef int                                         node_handle;
+    typedef detail::bounding_box< detail::has_width_member< T >::value, point_data_type > box_function;
+    typedef detail::object_bucket< T, point_data_type, box_function > bucket_type;
 
 public:
 
     typedef T                                           value_type;
+    typedef Instrument                                  instrumentation_type;
     typedef point< point_data_type >                    point_type;
     typedef line_segment< point_data_type >             line_type;
     typedef rectangle< point_data_type >                rectangle_type;
     typedef std::vector< T >                            result_type;
     typedef typename result_type::const_iterator        result_iterator;
     typedef unsigned                                    size_type;
+    typedef std::pair< size_type, const T * >           batch_match;
+    typedef std::vector< batch_match >                  batch_result_type;
+
+    /**
+     * The outcome of a raycast: the nearest object hit (nullptr if none),
+     * the point at which it was hit and the parameter t of that point along
+     * the segment (0 at p1, 1 at p2).
+     */
+    struct raycast_result
+    {
+        const T *   object;
+        point_type  point;
+        double      t;
+    };
 
     quad_tree( const rectangle_type & bounds, int max_levels, int max_objects )
 
-        : quad_tree( "00", bounds, 0, max_levels, max_objects )
+        : quad_tree( 1.0, bounds, max_levels, max_objects )
+    {}
+
+    /**
+     * @brief Bulk-load constructor
+     *
+     * Builds the tree from the objects in [first, last). The objects are
+     * sorted once by the cell key of their centre (the path of quadrants
+     * from the root down to the deepest level), after which each node is
+     * built in a single top-down pass: the objects belonging to a node's
+     * subtree are always a contiguous run of the sorted input, and each
+     * object is copied once, directly into its final node.
+     *
+     * The resulting tree holds the same objects in the same nodes as one
+     * built by calling insert() for every object.
+     */
+    template< typename Input_iterator >
+    quad_tree( const rectangle_type & bounds, int max_levels, int max_objects,
+               Input_iterator first, Input_iterator last )
+
+        : quad_tree( 1.0, bounds, max_levels, max_objects, first, last )
+    {}
+
+    /**
+     * @brief Parallel bulk-load constructor
+     *
+     * Builds the same tree as the bulk-load constructor above, using up to
+     * 'threads' threads. The levels above cutoff_level are built first, by
+     * partitioning the objects by quadrant; the (independent) subtrees rooted
+     * at cutoff_level are then bulk loaded concurrently, each into a pool of
+     * its own, and finally appended to this tree's pool. Apart from the
+     * order of the nodes within the pool, the result is identical to the
+     * serial build.
+     *
+     * A cutoff of n levels gives up to 4^n subtrees to share between the
+     * threads, so it should be chosen to leave several subtrees per thread.
+     */
+    template< typename Input_iterator >
+    quad_tree( const rectangle_type & bounds, int max_levels, int max_objects,
+               Input_iterator first, Input_iterator last, unsigned threads, int cutoff_level = 3 )
+
+        : quad_tree( bounds, max_levels, max_objects )
     {
+        container_type staged( first, last );
+
+        m_nodes.reserve( 1 + 4 * ( staged.size() / ( m_max_objects + 1 )));
+
+        parallel_build( staged, threads, cutoff_level );
     }
 
     quad_tree( const quad_tree & ) = delete;
     quad_tree & operator=( const quad_tree & ) = delete;
 
-    const std::string & id() const
+    /**
+     * @brief looseness
+     * @return The factor by which the bounds of each node are grown, about
+     * its centre, to give the region its objects may occupy (1 unless this
+     * is a loose_quad_tree).
+     */
+    double looseness() const
+    {
+        return m_looseness;
+    }
+
+    std::string id() const
     {
-        return m_id;
+        return id( root );
     }
 
     const rectangle_type & bounds() const
     {
-        return m_bounds;
+        return m_nodes[ root ].bounds;
     }
 
     /**
@@ -118,7 +245,7 @@ public:
      */
     bool is_leaf() const
     {
-        return m_children.empty();
+        return is_leaf( root );
     }
 
     /**
@@ -128,15 +255,26 @@ public:
      */
     size_type size() const
     {
-        size_type sz = m_objects.size();
+        size_type sz = 0;
 
-        for ( const auto & child : m_children )
+        for ( const node & n : m_nodes )
 
-            sz += child->size();
+            sz += n.objects.size();
 
         return sz;
     }
 
+    /**
+     * @brief node_count
+     * @return the number of nodes currently allocated in the pool. This
+     * includes the blocks of four released by merges (see erase), which
+     * are kept for reuse by later splits until clear().
+     */
+    size_type node_count() const
+    {
+        return m_nodes.size();
+    }
+
     /**
      * @brief retrieve
      *
@@ -147,23 +285,9 @@ public:
     template< typename Object_type >
     void retrieve( const Object_type & r, result_type & result ) const
     {
-        if ( !m_children.empty() )
-        {
-            int indices = intersects( r );
-
-            for ( int i = 0; i < 4; ++i )
-            {
-                if ( indices & (1<<i) )
-                {
-                    m_children[ i ]->retrieve( r, result );
-                }
-            }
-        }
+        const query_scope scope;
 
-        for ( const T & obj : m_objects)
-        {
-            result.push_back( obj );
-        }
+        for_each_match( root, r, [&result]( const T & obj ) { result.push_back( obj ); } );
     }
 
     /**
@@ -179,23 +303,9 @@ public:
     template< typename Object_type, typename Functor_type >
     void for_each_match( const Object_type & r, const Functor_type & f ) const
     {
-        if ( !is_leaf() )
-        {
-            int indices = intersects( r );
-
-            for ( int i = 0; i < 4; ++i )
-            {
-                if ( indices & (1<<i) )
-                {
-                    m_children[ i ]->for_each_match( r, f );
-                }
-            }
-        }
+        const query_scope scope;
 
-        for ( const T & obj : m_objects )
-        {
-            f( obj );
-        }
+        for_each_match( root, r, f );
     }
 
     /**
@@ -212,36 +322,85 @@ public:
     {
         if ( is_leaf() ) return;
 
-        std::deque< const_ptr > unvisited;
+        traversal_stack unvisited;
+        const query_scope scope;
 
-        unvisited.push_back( this );
+        unvisited.push( root );
 
         while( !unvisited.empty() )
         {
-            const_ptr current = unvisited.back();
-            unvisited.pop_back();
+            const node & current = m_nodes[ unvisited.pop() ];
+
+            if ( Instrument::enabled ) Instrument::visit_node( current.level );
 
-            if ( !current->is_leaf() )
+            if ( current.first_child != npos )
             {
-                int indices = current->intersects( r );
+                int indices = intersects( current, r );
 
                 for ( int i = 0; i < 4; ++i )
                 {
                     if ( indices & (1<<i) )
                     {
-                        unvisited.push_back( current->m_children[ i ].get() );
+                        unvisited.push( current.first_child + i );
                     }
                 }
 
             }
 
-            for ( const T & obj : current->m_objects )
+            if ( Instrument::enabled ) Instrument::emit( current.objects.size() );
+
+            for ( const T & obj : current.objects )
             {
                 f( obj );
             }
         }
     }
 
+    /**
+     * @brief for_each_overlap
+     *
+     * As for_each_match, but only calls the supplied function for objects
+     * whose bounding box actually overlaps that of the supplied object
+     * (edges touching count as overlapping), rather than for every object
+     * of every node visited. The test is run within each node, against the
+     * node's copy of its objects' boxes, four objects at a time.
+     *
+     * @param r The object to test against.
+     * @param f Callback function accepting an argument of type Object_type.
+     */
+    template< typename Object_type, typename Functor_type >
+    void for_each_overlap( const Object_type & r, const Functor_type & f ) const
+    {
+        const query_scope scope;
+        const typename bucket_type::box_type query = detail::bounding_box< detail::has_width_member< Object_type >::value, point_data_type >()( r );
+
+        for_each_overlap( root, r, query, f );
+    }
+
+    /**
+     * @brief within_radius
+     *
+     * Calls the supplied function for every object whose bounding box lies
+     * within distance r of p (touching counts). Nodes are only entered if
+     * they lie within r of p themselves, and each object is tested exactly,
+     * rather than against the bounding square of the circle. Objects reaching
+     * beyond the tree's bounds are held by the root (see index), so are found
+     * wherever p lies.
+     *
+     * @param p The centre of the circle.
+     * @param r Its radius.
+     * @param f Callback function accepting an argument of type T.
+     */
+    template< typename Functor_type >
+    void within_radius( const point_type & p, point_data_type r, const Functor_type & f ) const
+    {
+        const query_scope scope;
+        const typename bucket_type::box_type square = { point_data_type( p.x() - r ), point_data_type( p.y() - r ),
+                                                        point_data_type( p.x() + r ), point_data_type( p.y() + r ) };
+
+        within_radius( root, p, double( r ) * r, square, f );
+    }
+
     /**
      *
      * @brief line_intersect
@@ -260,28 +419,9 @@ public:
     template< typename Functor_type >
     void line_intersect( const line_type & l, const Functor_type & f ) const
     {
-        // inefficient to generate an AABB around a long line, so test which
-        // nodes are actually intersected by the given line
-
-        bool intersects = false;
-
-        for ( auto it = m_bounds.begin(); !intersects && it != m_bounds.end(); ++it )
-        {
-            intersects = has_intersect( l, *it );
-        }
-
-        if ( intersects || in_bounds( l.p1() ) || in_bounds( l.p2() ))
-        {
-            for ( const auto & child : m_children )
-            {
-                child->line_intersect( l, f );
-            }
+        const query_scope scope;
 
-            for ( const T & obj : m_objects )
-            {
-                f( obj );
-            }
-        }
+        line_intersect( root, l, f );
     }
 
     /**
@@ -301,31 +441,9 @@ public:
     template< typename Functor_type >
     void first_line_intersect( const line_type & l, const Functor_type & f ) const
     {
-        // inefficient to generate an AABB around a long line, so test which
-        // nodes are actually intersected by the given line
-
-        if ( !f.active() ) return;
-
-        bool intersects = false;
-
-        for ( auto it = m_bounds.begin(); !intersects && it != m_bounds.end(); ++it )
-        {
-            intersects = has_intersect( l, *it );
-        }
-
-        if ( intersects || in_bounds( l.p1() ) || in_bounds( l.p2() ))
-        {
-            for ( const auto & child : m_children )
-            {
-                if ( f.active() )
-                    child->first_line_intersect( l, f );
-            }
+        const query_scope scope;
 
-            for ( const T & obj : m_objects )
-            {
-                f( obj );
-            }
-        }
+        first_line_intersect( root, l, f );
     }
 
     /**
@@ -340,265 +458,1518 @@ public:
     template< typename Functor_type >
     void line_intersect_iterative( const line_type & l, const Functor_type & f ) const
     {
-        std::deque< const_ptr > unvisited;
-        std::deque< const_ptr > intersected;
-
-        const_ptr current_node = this;
+        traversal_stack unvisited;
+        const query_scope scope;
 
-        unvisited.push_back( this );
+        unvisited.push( root );
 
         while( !unvisited.empty() )
         {
-            const_ptr current = unvisited.back();
-            unvisited.pop_back();
-
-            bool intersects = false;
-
-            for ( auto it = m_bounds.begin(); !intersects && it != m_bounds.end(); ++it )
-            {
-                intersects = has_intersect( l, *it );
-            }
+            node_handle current = unvisited.pop();
 
-            if ( intersects || in_bounds( l.p1() ) || in_bounds( l.p2() ))
+            if ( line_in_node( current, l ))
             {
-                intersected.push_back( current );
+                if ( Instrument::enabled ) Instrument::visit_node( m_nodes[ current ].level );
 
-                for ( const auto & child : current->m_children )
+                if ( !is_leaf( current ))
                 {
-                    unvisited.push_back( child.get() );
+                    // pushed far to near, so the nearest child is popped first
+                    const int * order = front_to_back( l );
+
+                    for ( int i = 3; i >= 0; --i )
+                    {
+                        unvisited.push( m_nodes[ current ].first_child + order[ i ] );
+                    }
                 }
-            }
 
-        }
+                if ( Instrument::enabled ) Instrument::emit( m_nodes[ current ].objects.size() );
 
-        for ( auto i : intersected )
-        {
-            for ( const T & obj : i->m_objects )
-            {
-                f( obj );
+                for ( const T & obj : m_nodes[ current ].objects )
+                {
+                    f( obj );
+                }
             }
         }
     }
 
-    // mutators
-
     /**
      *
-     * @brief insert
-     *
-     * Insert an object into the correct node of the quad tree
+     * @brief line_intersect_packet
      *
-     * @param v an instance of the quad_tree's value_type.
+     * Provides the same results as calling line_intersect for each segment
+     * of [first, last), but traces the segments through the tree in packets
+     * of N, so that each node is read once per packet rather than once per
+     * segment. Each node is tested against every segment of the packet in
+     * one go, and segments which miss it are masked off below it. Works best
+     * when the segments of a packet are coherent, e.g. rays fanning out from
+     * a common origin.
      *
+     * @tparam N The packet size (4, 8 or 16 are the natural choices).
+     * @param first, last Random access range of line segments.
+     * @param f Callback function accepting ( size_type i, const T & obj ),
+     *        where i is the offset of the segment within [first, last).
      */
-    void insert( const value_type & v )
+    template< int N, typename Line_iterator, typename Functor_type >
+    void line_intersect_packet( Line_iterator first, Line_iterator last, const Functor_type & f ) const
     {
-        if ( !m_children.empty() )
-        {
-            int idx = index( v );
+        static_assert( N > 0 && N < 32, "packet lanes must fit in an unsigned mask" );
 
-            if ( idx != npos )
-            {
-                m_children[ idx ]->insert( v );
-                return;
-            }
-        }
-
-        m_objects.push_back( v );
+        const size_type count = std::distance( first, last );
 
-        if ( m_objects.size() > m_max_objects && m_level < m_max_levels )
+        for ( size_type base = 0; base < count; base += N )
         {
-            if ( m_children.empty() )
-                split();
+            segment_packet< point_data_type, N > packet;
 
-            for ( iterator it = begin(); it != end(); )
+            for ( size_type i = base; i < count && i < base + N; ++i )
             {
-                int idx = index( *it );
-                if ( idx != npos )
-                {
-                    m_children[ idx ]->insert( *it );
-                    it = m_objects.erase( it );
-                }
-                else
-                {
-                    ++it;
-                }
+                packet.push_back( first[ i ] );
             }
 
+            line_intersect( root, packet, ( 1u << packet.size() ) - 1, base, f );
         }
     }
 
     /**
      *
-     * @brief clear
+     * @brief raycast
+     *
+     * Finds the object hit nearest to p1 along the segment l. Nodes are
+     * searched best-first, in order of the parameter t at which the segment
+     * enters them, and the search ends as soon as no remaining node is
+     * entered before the best hit found so far.
      *
-     * Clear the entire quad tree
+     * @param l The segment to cast.
+     * @param hit_test Function accepting ( const T &, const line_type & ) and
+     *        returning std::pair< bool, point_type >, as intersect() does.
+     *        For objects holding a segment, for example:
+     *        [](const wall & w, const line_type & l) { return intersect( l, w.segment() ); }
+     * @return The nearest hit; its object is nullptr if nothing was hit.
      */
-    void clear()
-    {
-        m_objects.clear();
-
-        for ( quad_tree * q : m_children )
-        {
-            if( q ) q->clear();
-        }
-    }
-
-private:
-
-    static unique_ptr create( const std::string & id, const rectangle_type & bounds, size_type level, int max_levels, int max_objects )
-    {
-        return unique_ptr( new quad_tree( id, bounds, level, max_levels, max_objects ));
-    }
-
-    unique_ptr create( const std::string & id, const rectangle_type & r ) const
+    template< typename Hit_test >
+    raycast_result raycast( const line_type & l, const Hit_test & hit_test ) const
     {
-        return create( id, r, m_level + 1, m_max_levels, m_max_objects );
-    }
-
-    quad_tree( const std::string & id, const rectangle_type & bounds, size_type level, int max_levels, int max_objects )
+        const query_scope scope;
 
-        : m_id( id )
-        , m_bounds( bounds )
-        , m_level( level )
-        , m_max_levels( max_levels )
-        , m_max_objects( max_objects )
-    {
+        return best_first_raycast( l, custom_hit< Hit_test >{ hit_test } );
     }
 
-    friend class detail::index<detail::POINT_TYPE, point_data_type>;
-    friend class detail::index<detail::RECTANGLE_TYPE, point_data_type>;
-    friend class detail::intersects<detail::POINT_TYPE, point_data_type>;
-    friend class detail::intersects<detail::RECTANGLE_TYPE, point_data_type>;
-
-    iterator begin()
+    /**
+     * @brief raycast
+     *
+     * As above, where an object is hit where the segment enters its
+     * bounding box (or at p1, if it starts inside it).
+     */
+    raycast_result raycast( const line_type & l ) const
     {
-        return m_objects.begin();
-    }
+        const query_scope scope;
 
-    iterator end()
-    {
-        return m_objects.end();
+        return best_first_raycast( l, box_hit() );
     }
 
-    template< typename Obj_type >
-    int index( const Obj_type & obj ) const
+    /**
+     *
+     * @brief nearest
+     *
+     * Finds the k objects nearest to p, measured to the nearest point of
+     * their bounding boxes, and passes them to sink nearest first. Nodes
+     * are searched best-first, in order of their distance from p, and any
+     * node further away than the k-th nearest object found so far is never
+     * entered.
+     *
+     * @param p The point to search from.
+     * @param k The number of objects wanted; fewer are found if the tree
+     *        holds fewer.
+     * @param sink Function accepting ( const T & ).
+     */
+    template< typename Functor_type >
+    void nearest( const point_type & p, size_type k, const Functor_type & sink ) const
     {
-        return detail::index< detail::has_width_member< Obj_type >::value, point_data_type >()( this, obj );
-    }
+        typedef std::pair< double, const T * > candidate_type;
 
-    template< typename Obj_type >
-    int intersects( const Obj_type & obj ) const
-    {
-        return detail::intersects< detail::has_width_member< Obj_type >::value, point_data_type >()( this, obj );
-    }
+        if ( k == 0 ) return;
 
-    bool in_bounds( const point_type & p ) const
-    {
-        return ( p.x() >= m_bounds.x() && p.x() <= m_bounds.x() + m_bounds.width() ) &&
-               ( p.y() >= m_bounds.y() && p.y() <= m_bounds.y() + m_bounds.height() );
-    }
+        const query_scope scope;
+        detail::small_priority_queue< candidate_type, 64 > found;
+        best_first_nearest( p, k, found );
 
-    void split()
-    {
-        point_data_type half_width = m_bounds.width() / 2;
-        point_data_type half_height = m_bounds.height() / 2;
-        m_children.push_back( create( std::string( m_id + ".00" ), rectangle_type( m_bounds.x(), m_bounds.y(), half_width, half_height )));
-        m_children.push_back( create( std::string( m_id + ".01" ), rectangle_type( m_bounds.x() + half_width, m_bounds.y(), half_width, half_height )));
-        m_children.push_back( create( std::string( m_id + ".10" ), rectangle_type( m_bounds.x() + half_width, m_bounds.y() + half_height, half_width, half_height )));
-        m_children.push_back( create( std::string( m_id + ".11" ), rectangle_type( m_bounds.x(), m_bounds.y() + half_height, half_width, half_height )));
+        detail::sink_nearest_first< T >( found, sink );
     }
 
-private:
-    std::string                 m_id;
-    rectangle_type              m_bounds;
-    size_type                   m_level;
-    size_type                   m_max_levels;
-    size_type                   m_max_objects;
-    std::vector< unique_ptr >   m_children;
-    container_type              m_objects;
-};
-
-/**
- * @brief Output stream operator specialised for quad_tree types.
- */
-template< typename T >
-std::ostream & operator<<( std::ostream & os, const quad_tree< T > & q )
-{
-    os << "<quadtree id:" << q.id() << ">";
-    return os;
-}
-
-/**
- * @namespace detail
- */
-namespace detail
-{
-    /*
-     * quad_tree helper functions, which operate on either rectangular data
-     * structures or point data structures
-     */
-
     /**
-     * @brief index
      *
-     * Locate the quad node index of a rectangle, or -1 if the recangle
-     * doesn't fully fit into one quad.
+     * @brief query_batch
+     *
+     * Runs for_each_match for every query in [first, last), sharing the
+     * queries between worker threads. Each worker appends (query index,
+     * object) pairs to a flat buffer of its own, so nothing is shared or
+     * locked while querying. The matches of any one query are contiguous
+     * within a single buffer.
+     *
+     * @param first, last Random access range of query shapes.
+     * @param results One buffer per worker thread on return. Their storage
+     *        is reused, so passing the same buffers each time avoids
+     *        allocating in steady state.
+     * @param threads The number of threads to use.
+     * @param morton_order Run the queries in order of the cell key of their
+     *        centre, so that consecutive queries visit the same nodes.
      */
-    template<typename Data_type>
-    struct index<RECTANGLE_TYPE, Data_type>
+    template< typename Query_iterator >
+    void query_batch( Query_iterator first, Query_iterator last, std::vector< batch_result_type > & results,
+                      unsigned threads = detail::default_thread_count(), bool morton_order = false ) const
     {
-        template< typename T, typename Rect_type >
-        int operator()( const quad_tree<T> * q, const Rect_type & r ) const
+        const size_type count = std::distance( first, last );
+
+        std::vector< size_type > order( count );
+
+        if ( morton_order )
         {
-            int result = quad_tree<T>::npos;
+            const int levels = std::min< int >( max_key_levels, m_max_levels );
 
-            Data_type x_midpoint = q->m_bounds.x() + q->m_bounds.width() / 2;
-            Data_type y_midpoint = q->m_bounds.y() + q->m_bounds.height() / 2;
+            keyed_offset_array keyed;
+            keyed.reserve( count );
 
-            bool bottom_half = r.y() < y_midpoint && r.y() + r.height() < y_midpoint;
-            bool top_half = r.y() >= y_midpoint;
+            for ( size_type i = 0; i < count; ++i )
+            {
+                keyed.push_back( keyed_offset( cell_key( bounds(), first[ i ], levels ), i ));
+            }
 
-            // fits in left half:
-            if ( ( r.x() < x_midpoint ) && ( r.x() + r.width() < x_midpoint ) )
+            detail::sort_by_key( keyed, 2 * levels );
+
+            for ( size_type i = 0; i < count; ++i )
             {
-                if ( top_half )         result = 3;
-                else if ( bottom_half ) result = 0;
+                order[ i ] = keyed[ i ].second;
             }
-            // fits in right half:
-            else if ( r.x() >= x_midpoint )
+        }
+        else
+        {
+            for ( size_type i = 0; i < count; ++i )
             {
-                if ( top_half )         result = 2;
-                else if ( bottom_half ) result = 1;
+                order[ i ] = i;
             }
-
-            return result;
         }
 
-    };
+        detail::run_batch( count, threads, batch_grain, results,
+            [&]( std::size_t i, batch_result_type & matches )
+            {
+                const size_type q = order[ i ];
+
+                for_each_match( root, first[ q ], [&matches, q]( const T & obj ) { matches.push_back( batch_match( q, &obj )); } );
+            });
+    }
 
     /**
-     * @brief intersects
      *
-     * Locate all the indices of quads which are intersected by the supplied shape
+     * @brief query_batch
+     *
+     * As above, but passes each worker's buffer to the supplied sink (on the
+     * calling thread) once all of the queries have run.
+     *
+     * @param sink Function accepting a const batch_result_type &.
      */
-    template< typename Data_type >
-    struct intersects<RECTANGLE_TYPE, Data_type>
+    template< typename Query_iterator, typename Sink_type >
+    void query_batch( Query_iterator first, Query_iterator last, const Sink_type & sink,
+                      unsigned threads = detail::default_thread_count(), bool morton_order = false ) const
     {
-        template< typename T, typename Rect_type >
-        int operator()( const quad_tree<T> * q, const Rect_type & r ) const
-        {
-            typedef typename quad_tree< T >::point_type point_type;
+        std::vector< batch_result_type > results;
 
-            std::vector< point_type > corners = rectangle_corners( r );
+        query_batch( first, last, results, threads, morton_order );
 
-            int result = 0;
+        for ( const batch_result_type & matches : results )
+        {
+            sink( matches );
+        }
+    }
+
+    /**
+     *
+     * @brief save
+     *
+     * Writes the tree to path as a flat, pointer-free image (see
+     * detail::image_header), which quad_tree_view can map and query in
+     * place, with the same results as this tree. Requires a trivially
+     * copyable T, as objects are written byte for byte.
+     *
+     * Throws std::runtime_error if the file cannot be written.
+     */
+    void save( const std::string & path ) const
+    {
+        static_assert( std::is_trivially_copyable< T >::value, "quad_tree::save requires trivially copyable objects" );
+
+        typedef detail::image_node< point_data_type > image_node;
+
+        std::vector< image_node > nodes( m_nodes.size() );
+        std::uint64_t objects = 0;
+
+        for ( size_type h = 0; h < m_nodes.size(); ++h )
+        {
+            const node & n = m_nodes[ h ];
+            const rectangle_type q = query_bounds( h );
+            const point_data_type b[ 4 ] = { n.bounds.x(), n.bounds.y(), n.bounds.width(), n.bounds.height() };
+            const point_data_type qb[ 4 ] = { q.x(), q.y(), q.width(), q.height() };
+
+            std::copy( b, b + 4, nodes[ h ].bounds );
+            std::copy( qb, qb + 4, nodes[ h ].query_bounds );
+            nodes[ h ].first_child = n.first_child;
+            nodes[ h ].object_count = n.objects.size();
+            nodes[ h ].first_object = objects;
+
+            objects += n.objects.size();
+        }
+
+        detail::image_header header;
+
+        std::memcpy( header.magic, detail::image_magic, sizeof( header.magic ));
+        header.version = detail::image_header::current_version;
+        header.value_size = sizeof( T );
+        header.coordinate_size = sizeof( point_data_type );
+        header.node_count = m_nodes.size();
+        header.object_count = objects;
+        header.nodes_offset = detail::image_align( sizeof( header ));
+        header.objects_offset = detail::image_align( header.nodes_offset + nodes.size() * sizeof( image_node ));
+        header.loose = is_loose();
+        header.reserved = 0;
+        header.looseness = m_looseness;
+
+        std::ofstream out( path.c_str(), std::ios::binary | std::ios::trunc );
+
+        if ( !out ) throw std::runtime_error( "quad_tree::save: cannot open " + path );
+
+        const char padding[ 16 ] = {};
+
+        out.write( reinterpret_cast< const char * >( &header ), sizeof( header ));
+        out.write( padding, header.nodes_offset - sizeof( header ));
+        out.write( reinterpret_cast< const char * >( nodes.data() ), nodes.size() * sizeof( image_node ));
+        out.write( padding, header.objects_offset - header.nodes_offset - nodes.size() * sizeof( image_node ));
+
+        for ( const node & n : m_nodes )
+        {
+            if ( !n.objects.empty() )
+                out.write( reinterpret_cast< const char * >( &n.objects[ 0 ] ), n.objects.size() * sizeof( T ));
+        }
+
+        if ( !out.flush() ) throw std::runtime_error( "quad_tree::save: cannot write " + path );
+    }
+
+    // mutators
+
+    /**
+     *
+     * @brief insert
+     *
+     * Insert an object into the correct node of the quad tree
+     *
+     * @param v an instance of the quad_tree's value_type.
+     *
+     */
+    void insert( const value_type & v )
+    {
+        insert( root, v );
+    }
+
+    /**
+     *
+     * @brief erase
+     *
+     * Removes one object equal to v (under eq) from the tree. If that leaves
+     * a node's children, along with the node itself, holding fewer than
+     * max_objects between them, the children are merged back into the node,
+     * and so on up the tree. A node splits once it holds more than
+     * max_objects, so one holding exactly that many is neither split nor
+     * merged, and an insert and erase at the threshold do not alternate.
+     *
+     * @return false if no such object is held.
+     */
+    template< typename Equal = std::equal_to< T > >
+    bool erase( const value_type & v, const Equal & eq = Equal() )
+    {
+        const object_location loc = find( v, eq );
+
+        if ( loc.first == npos ) return false;
+
+        m_nodes[ loc.first ].objects.erase( loc.second );
+        merge( loc.first );
+        return true;
+    }
+
+    /**
+     *
+     * @brief move
+     *
+     * Replaces one object equal to from (under eq) with to, typically the
+     * same object with new bounds. If to still belongs in the node holding
+     * from, it is updated in place; otherwise it is re-inserted from the
+     * nearest ancestor whose region it lies within, rather than from the
+     * root, and the node it left is merged as for erase.
+     *
+     * @return false if no object equal to from is held (to is not inserted).
+     */
+    template< typename Equal = std::equal_to< T > >
+    bool move( const value_type & from, const value_type & to, const Equal & eq = Equal() )
+    {
+        const object_location loc = find( from, eq );
+
+        if ( loc.first == npos ) return false;
+
+        const node_handle h = loc.first;
+        const node_handle a = enclosing( h, to );
+
+        if ( a == h && ( is_leaf( h ) || index( m_nodes[ h ], to ) == npos ))
+        {
+            m_nodes[ h ].objects.set( loc.second, to );
+            return true;
+        }
+
+        m_nodes[ h ].objects.erase( loc.second );
+        insert( a, to );
+
+        // inserting to may have split h, or h may now be a descendant of
+        // an underfull node
+        merge( h );
+        return true;
+    }
+
+    /**
+     *
+     * @brief clear
+     *
+     * Clear the entire quad tree, collapsing it back to its root.
+     */
+    void clear()
+    {
+        m_nodes.erase( m_nodes.begin() + 1, m_nodes.end() );
+        m_nodes[ root ].first_child = npos;
+        m_nodes[ root ].objects.clear();
+        m_free_blocks.clear();
+    }
+
+protected:
+
+    /**
+     * Constructors for loose_quad_tree: as above, where objects are placed
+     * by their centre, in the child whose bounds grown by looseness about
+     * its centre hold them.
+     */
+    quad_tree( double looseness, const rectangle_type & bounds, int max_levels, int max_objects )
+
+        : m_max_levels( max_levels )
+        , m_max_objects( max_objects )
+        , m_looseness( is_loose() ? looseness : 1.0 )
+    {
+        m_nodes.push_back( node( bounds, 0, npos ));
+    }
+
+    template< typename Input_iterator >
+    quad_tree( double looseness, const rectangle_type & bounds, int max_levels, int max_objects,
+               Input_iterator first, Input_iterator last )
+
+        : quad_tree( looseness, bounds, max_levels, max_objects )
+    {
+        container_type staged( first, last );
+        key_array keys( staged.size() );
+
+        // a node is only split once more than max_objects fall within it, so
+        // this is a reasonable estimate of the final pool size
+        m_nodes.reserve( 1 + 4 * ( staged.size() / ( m_max_objects + 1 )));
+
+        build( m_nodes, root, staged, keys, 0, staged.size(), 0, 0 );
+    }
+
+private:
+
+    enum { root = 0 };
+
+    // number of consecutive queries a batch worker claims at a time
+    enum { batch_grain = 32 };
+
+    // pending nodes of the iterative traversals; a depth-first walk holds at
+    // most 3 per level below the root, so this is enough for 21 levels
+    // before touching the heap
+    typedef detail::small_stack< node_handle, 64 > traversal_stack;
+
+    /**
+     * A single quad node. The children of a node (if any) are held in the
+     * pool at [first_child, first_child + 4).
+     */
+    struct node
+    {
+        node( const rectangle_type & b, size_type l, node_handle p )
+
+            : bounds( b )
+            , level( l )
+            , parent( p )
+            , first_child( npos )
+        {
+        }
+
+        rectangle_type          bounds;
+        size_type               level;
+        node_handle             parent;
+        node_handle             first_child;
+        bucket_type             objects;
+    };
+
+    typedef std::vector< node >                         node_pool;
+
+    // the node holding an object, and its position within the node's bucket
+    typedef std::pair< node_handle, size_type > object_location;
+
+    bool is_leaf( node_handle h ) const
+    {
+        return m_nodes[ h ].first_child == npos;
+    }
+
+    std::string id( node_handle h ) const
+    {
+        static const char * const quadrant_ids[ 4 ] = { ".00", ".01", ".10", ".11" };
+
+        const node & n = m_nodes[ h ];
+
+        if ( n.parent == npos ) return "00";
+
+        return id( n.parent ) + quadrant_ids[ h - m_nodes[ n.parent ].first_child ];
+    }
+
+    template< typename Object_type, typename Functor_type >
+    void for_each_match( node_handle h, const Object_type & r, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( Instrument::enabled ) Instrument::visit_node( n.level );
+
+        if ( n.first_child != npos )
+        {
+            int indices = intersects( n, r );
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( indices & (1<<i) )
+                {
+                    for_each_match( n.first_child + i, r, f );
+                }
+            }
+        }
+
+        if ( Instrument::enabled ) Instrument::emit( n.objects.size() );
+
+        for ( const T & obj : n.objects )
+        {
+            f( obj );
+        }
+    }
+
+    template< typename Object_type, typename Functor_type >
+    void for_each_overlap( node_handle h, const Object_type & r, const typename bucket_type::box_type & query, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( Instrument::enabled ) Instrument::visit_node( n.level );
+
+        if ( n.first_child != npos )
+        {
+            int indices = intersects( n, r );
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( indices & (1<<i) )
+                {
+                    for_each_overlap( n.first_child + i, r, query, f );
+                }
+            }
+        }
+
+        const typename detail::emitting_function< Instrument, T, Functor_type >::type & emitting_f = f;
+
+        n.objects.for_each_overlap( query, emitting_f );
+    }
+
+    template< typename Functor_type >
+    void within_radius( node_handle h, const point_type & p, double r2, const typename bucket_type::box_type & square, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( Instrument::enabled ) Instrument::visit_node( n.level );
+
+        if ( n.first_child != npos )
+        {
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( squared_distance( p, object_bounds( n.first_child + i )) <= r2 )
+                {
+                    within_radius( n.first_child + i, p, r2, square, f );
+                }
+            }
+        }
+
+        // the bounding square of the circle rules out most objects four at
+        // a time, leaving the exact test for those near it
+        n.objects.for_each_overlap( square, [&]( const T & obj )
+        {
+            if ( object_distance( p, obj ) <= r2 )
+            {
+                if ( Instrument::enabled ) Instrument::emit();
+                f( obj );
+            }
+        });
+    }
+
+    template< typename Functor_type >
+    void line_intersect( node_handle h, const line_type & l, const Functor_type & f ) const
+    {
+        // inefficient to generate an AABB around a long line, so test which
+        // nodes are actually intersected by the given line
+
+        if ( line_in_node( h, l ))
+        {
+            const node & n = m_nodes[ h ];
+
+            if ( Instrument::enabled ) Instrument::visit_node( n.level );
+
+            if ( n.first_child != npos )
+            {
+                const int * order = front_to_back( l );
+
+                for ( int i = 0; i < 4; ++i )
+                {
+                    line_intersect( n.first_child + order[ i ], l, f );
+                }
+            }
+
+            if ( Instrument::enabled ) Instrument::emit( n.objects.size() );
+
+            for ( const T & obj : n.objects )
+            {
+                f( obj );
+            }
+        }
+    }
+
+    template< typename Functor_type >
+    void first_line_intersect( node_handle h, const line_type & l, const Functor_type & f ) const
+    {
+        // inefficient to generate an AABB around a long line, so test which
+        // nodes are actually intersected by the given line
+
+        if ( !f.active() ) return;
+
+        if ( line_in_node( h, l ))
+        {
+            const node & n = m_nodes[ h ];
+
+            if ( Instrument::enabled ) Instrument::visit_node( n.level );
+
+            if ( n.first_child != npos )
+            {
+                const int * order = front_to_back( l );
+
+                for ( int i = 0; i < 4; ++i )
+                {
+                    if ( f.active() )
+                        first_line_intersect( n.first_child + order[ i ], l, f );
+                }
+            }
+
+            if ( Instrument::enabled ) Instrument::emit( n.objects.size() );
+
+            for ( const T & obj : n.objects )
+            {
+                f( obj );
+            }
+        }
+    }
+
+    /**
+     * Does the line segment either cross an edge of the node, or have an
+     * endpoint within it (see has_intersect in geom.h).
+     */
+    bool line_in_node( node_handle h, const line_type & l ) const
+    {
+        if ( Instrument::enabled ) Instrument::edge_test();
+
+        return has_intersect( l, query_bounds( h ));
+    }
+
+    static constexpr bool is_loose()
+    {
+        return Nodes::loose;
+    }
+
+    /**
+     * Grows b by the looseness factor about its centre.
+     */
+    rectangle_type loosen( const rectangle_type & b ) const
+    {
+        const point_data_type margin_x = point_data_type( ( m_looseness - 1.0 ) / 2 * b.width() );
+        const point_data_type margin_y = point_data_type( ( m_looseness - 1.0 ) / 2 * b.height() );
+
+        return rectangle_type( b.x() - margin_x, b.y() - margin_y, b.width() + 2 * margin_x, b.height() + 2 * margin_y );
+    }
+
+    /**
+     * The bounds against which queries test a node: in a loose tree, those
+     * of the region its objects may occupy.
+     */
+    rectangle_type query_bounds( node_handle h ) const
+    {
+        return is_loose() ? loosen( m_nodes[ h ].bounds ) : m_nodes[ h ].bounds;
+    }
+
+    /**
+     * Hit tests for raycast: each reports whether an object is hit, and
+     * if so where and at what parameter along the segment.
+     */
+    template< typename Hit_test >
+    struct custom_hit
+    {
+        bool operator()( const T & obj, const line_type & l, point_type & p, double & t ) const
+        {
+            std::pair< bool, point_type > hit = hit_test( obj, l );
+
+            if ( !hit.first ) return false;
+
+            p = hit.second;
+            t = parameter_of( l, p );
+            return true;
+        }
+
+        const Hit_test & hit_test;
+    };
+
+    struct box_hit
+    {
+        bool operator()( const T & obj, const line_type & l, point_type & p, double & t ) const
+        {
+            const detail::box< point_data_type > b = box_function()( obj );
+            std::pair< bool, double > entry = clip( l, rectangle_type( b.min_x, b.min_y, b.max_x - b.min_x, b.max_y - b.min_y ));
+
+            if ( !entry.first ) return false;
+
+            t = entry.second;
+            p = point_at( l, t );
+            return true;
+        }
+    };
+
+    /**
+     * The region which may hold the objects of a node. With integral
+     * coordinates, halving an odd width or height drops a unit from the
+     * upper children, so their objects may reach up to one unit per level
+     * beyond the node's right and top edges.
+     */
+    rectangle_type object_bounds( node_handle h ) const
+    {
+        // objects are placed by the loosened bounds of their node, so they
+        // lie within them exactly
+        if ( is_loose() ) return query_bounds( h );
+
+        const node & n = m_nodes[ h ];
+        const point_data_type slack = std::is_integral< point_data_type >::value ? point_data_type( n.level ) : point_data_type( 0 );
+
+        return rectangle_type( n.bounds.x(), n.bounds.y(), n.bounds.width() + slack, n.bounds.height() + slack );
+    }
+
+    template< typename Hit_type >
+    raycast_result best_first_raycast( const line_type & l, const Hit_type & hit ) const
+    {
+        typedef std::pair< double, node_handle > entry_type;
+
+        detail::small_priority_queue< entry_type, 64, std::greater< entry_type > > open;
+        raycast_result best = { nullptr, l.p2(), std::numeric_limits< double >::max() };
+
+        // objects reaching beyond the tree's bounds are held by the root
+        // (see index), so it is searched whether or not the segment enters it
+        open.push( entry_type( 0.0, root ));
+
+        while ( !open.empty() && open.top().first < best.t )
+        {
+            const node & n = m_nodes[ open.top().second ];
+            open.pop();
+
+            if ( Instrument::enabled )
+            {
+                Instrument::visit_node( n.level );
+                Instrument::emit( n.objects.size() );
+            }
+
+            point_type p = point_type::zero();
+            double t = 0.0;
+
+            for ( const T & obj : n.objects )
+            {
+                if ( hit( obj, l, p, t ) && t < best.t )
+                {
+                    best.object = &obj;
+                    best.point = p;
+                    best.t = t;
+                }
+            }
+
+            if ( n.first_child != npos )
+            {
+                for ( int i = 0; i < 4; ++i )
+                {
+                    if ( Instrument::enabled ) Instrument::edge_test();
+
+                    std::pair< bool, double > entry = clip( l, object_bounds( n.first_child + i ));
+
+                    if ( entry.first && entry.second < best.t )
+                        open.push( entry_type( entry.second, n.first_child + i ));
+                }
+            }
+        }
+
+        return best;
+    }
+
+    // the squared distance from p to the bounding box of obj
+    static double object_distance( const point_type & p, const T & obj )
+    {
+        const detail::box< point_data_type > b = box_function()( obj );
+
+        return squared_distance( p, rectangle_type( b.min_x, b.min_y, b.max_x - b.min_x, b.max_y - b.min_y ));
+    }
+
+    /**
+     * Leaves in found the k objects nearest to p (or all of them, if there
+     * are fewer), as ( squared distance, object ) with the furthest on top.
+     */
+    template< typename Queue_type >
+    void best_first_nearest( const point_type & p, size_type k, Queue_type & found ) const
+    {
+        // the root is searched first, whatever its distance, as it holds
+        // the objects reaching beyond the tree's bounds (see index)
+        detail::nearest_search< T, node_handle, Queue_type > search( found, k, root );
+        node_handle h;
+
+        while ( search.next( h ))
+        {
+            const node & n = m_nodes[ h ];
+
+            if ( Instrument::enabled )
+            {
+                Instrument::visit_node( n.level );
+                Instrument::emit( n.objects.size() );
+            }
+
+            for ( const T & obj : n.objects )
+            {
+                search.offer( object_distance( p, obj ), obj );
+            }
+
+            if ( n.first_child != npos )
+            {
+                for ( int i = 0; i < 4; ++i )
+                {
+                    search.offer_node( squared_distance( p, object_bounds( n.first_child + i )), n.first_child + i );
+                }
+            }
+        }
+    }
+
+    /**
+     * The order in which to visit the children of a node, nearest first,
+     * for a segment running from p1 towards p2. The child containing the
+     * start of the segment's direction comes first, the diagonally
+     * opposite one last.
+     */
+    static const int * front_to_back( const line_type & l )
+    {
+        return front_to_back( ( l.p2().x() < l.p1().x() ) | ( l.p2().y() < l.p1().y() ) << 1 );
+    }
+
+    // as above, given the direction as ( dx < 0 ) | ( dy < 0 ) << 1
+    static const int * front_to_back( int direction )
+    {
+        static const int order[ 4 ][ 4 ] = { { 0, 1, 3, 2 },      // +x, +y
+                                              { 1, 0, 2, 3 },      // -x, +y
+                                              { 3, 0, 2, 1 },      // +x, -y
+                                              { 2, 1, 3, 0 } };    // -x, -y
+
+        return order[ direction ];
+    }
+
+    template< typename Packet_type, typename Functor_type >
+    void line_intersect( node_handle h, const Packet_type & packet, unsigned active, size_type base, const Functor_type & f ) const
+    {
+        // lanes whose segment misses this node drop out of the packet here
+        active &= packet.touches( query_bounds( h ));
+
+        if ( !active ) return;
+
+        const node & n = m_nodes[ h ];
+
+        int first = 0;
+
+        while ( !( active & ( 1u << first )))
+            ++first;
+
+        if ( n.first_child != npos )
+        {
+            // coherent packets share a direction, so order the children by
+            // that of the first active segment
+            const int * order = front_to_back( packet.direction( first ));
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                line_intersect( n.first_child + order[ i ], packet, active, base, f );
+            }
+        }
+
+        for ( int i = first; ( active >> i ) != 0; ++i )
+        {
+            if ( active & ( 1u << i ))
+            {
+                for ( const T & obj : n.objects )
+                {
+                    f( base + i, obj );
+                }
+            }
+        }
+    }
+
+    void insert( node_handle h, const value_type & v )
+    {
+        while ( !is_leaf( h ))
+        {
+            int idx = index( m_nodes[ h ], v );
+
+            if ( idx == npos ) break;
+
+            h = m_nodes[ h ].first_child + idx;
+        }
+
+        bucket_type & target = m_nodes[ h ].objects;
+
+        // a node holds at most m_max_objects + 1 before it splits, so size
+        // the bucket once rather than letting it grow through reallocation
+        if ( target.capacity() == 0 )
+            target.reserve( m_max_objects + 1 );
+
+        target.push_back( v );
+
+        // a node which already has children only holds objects straddling
+        // its midlines, which v (having stopped here) is one of
+        if ( is_leaf( h ) && m_nodes[ h ].objects.size() > m_max_objects && m_nodes[ h ].level < m_max_levels )
+        {
+            split( h );
+
+            // the pool may grow while pushing objects down, so the node is
+            // always re-fetched through its handle rather than held by reference
+            size_type kept = 0;
+
+            for ( size_type i = 0; i < m_nodes[ h ].objects.size(); ++i )
+            {
+                int idx = index( m_nodes[ h ], m_nodes[ h ].objects[ i ] );
+
+                if ( idx != npos )
+                {
+                    insert( m_nodes[ h ].first_child + idx, m_nodes[ h ].objects[ i ] );
+                }
+                else
+                {
+                    if ( kept != i )
+                        m_nodes[ h ].objects.set( kept, m_nodes[ h ].objects[ i ] );
+                    ++kept;
+                }
+            }
+
+            m_nodes[ h ].objects.truncate( kept );
+        }
+    }
+
+    /**
+     * Finds an object equal to v. Objects are always held by the node at
+     * the end of the path insert would take for them (splits push them down
+     * that path, merges make their node's parent its end), so that is the
+     * only node searched.
+     */
+    template< typename Equal >
+    object_location find( const value_type & v, const Equal & eq ) const
+    {
+        node_handle h = root;
+
+        while ( !is_leaf( h ))
+        {
+            const int idx = index( m_nodes[ h ], v );
+
+            if ( idx == npos ) break;
+
+            h = m_nodes[ h ].first_child + idx;
+        }
+
+        // an equal object has the same bounding box, so only the objects
+        // overlapping it need be compared
+        const bucket_type & objects = m_nodes[ h ].objects;
+        const size_type i = objects.find_if( box_function()( v ), [&]( const T & obj ) { return eq( obj, v ); } );
+
+        if ( i == objects.size() )
+            return object_location( node_handle( npos ), 0 );
+
+        return object_location( h, i );
+    }
+
+    /**
+     * The deepest node, of h and its ancestors, on the path insert would
+     * take for v.
+     */
+    node_handle enclosing( node_handle h, const value_type & v ) const
+    {
+        node_handle result = h;
+
+        for ( node_handle c = h; c != root; c = m_nodes[ c ].parent )
+        {
+            const node & p = m_nodes[ m_nodes[ c ].parent ];
+
+            if ( index( p, v ) != c - p.first_child )
+                result = m_nodes[ c ].parent;
+        }
+
+        return result;
+    }
+
+    /**
+     * Merges the children of h (or of its parent, if h is a leaf) back into
+     * it if together they hold fewer than m_max_objects, then does the
+     * same for each ancestor in turn. The four released nodes are kept for
+     * reuse by the next split.
+     */
+    void merge( node_handle h )
+    {
+        if ( is_leaf( h ))
+            h = m_nodes[ h ].parent;
+
+        for ( ; h != npos; h = m_nodes[ h ].parent )
+        {
+            const node_handle first = m_nodes[ h ].first_child;
+
+            if ( first == npos ) continue;
+
+            size_type total = m_nodes[ h ].objects.size();
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( !is_leaf( first + i )) return;
+
+                total += m_nodes[ first + i ].objects.size();
+            }
+
+            if ( total >= m_max_objects ) return;
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                bucket_type & objects = m_nodes[ first + i ].objects;
+
+                for ( const T & obj : objects )
+                {
+                    m_nodes[ h ].objects.push_back( obj );
+                }
+
+                objects.clear();
+            }
+
+            m_nodes[ h ].first_child = npos;
+            m_free_blocks.push_back( first );
+        }
+    }
+
+    template< typename Obj_type >
+    int index( const node & n, const Obj_type & obj ) const
+    {
+        // objects reaching beyond the tree's bounds are held by the root,
+        // as otherwise they would be placed in the children along that edge
+        if ( n.level == 0 && !within( n.bounds, obj )) return npos;
+
+        if ( is_loose() ) return loose_index( n.bounds, obj );
+
+        return detail::index< detail::has_width_member< Obj_type >::value, point_data_type >()( n.bounds, obj );
+    }
+
+    /**
+     * The child of a node with bounds b in which obj is placed in a loose
+     * tree: the quadrant of its centre, if the loosened bounds of that child
+     * hold it, otherwise npos.
+     */
+    template< typename Obj_type >
+    int loose_index( const rectangle_type & b, const Obj_type & obj ) const
+    {
+        const point_type c = detail::centre< detail::has_width_member< Obj_type >::value, point_data_type >()( obj );
+        const int q = detail::index< detail::POINT_TYPE, point_data_type >()( b, c );
+
+        // the child's bounds, as split() makes them
+        const point_data_type half_width = b.width() / 2;
+        const point_data_type half_height = b.height() / 2;
+        const rectangle_type child( b.x() + ( q == 1 || q == 2 ? half_width : 0 ), b.y() + ( q >= 2 ? half_height : 0 ), half_width, half_height );
+
+        return within( loosen( child ), obj ) ? q : npos;
+    }
+
+    template< typename Obj_type >
+    static bool within( const rectangle_type & bounds, const Obj_type & obj )
+    {
+        const detail::box< point_data_type > b = detail::bounding_box< detail::has_width_member< Obj_type >::value, point_data_type >()( obj );
+
+        return b.min_x >= bounds.x() && b.max_x <= bounds.x() + bounds.width() &&
+               b.min_y >= bounds.y() && b.max_y <= bounds.y() + bounds.height();
+    }
+
+    template< typename Obj_type >
+    int intersects( const node & n, const Obj_type & obj ) const
+    {
+        if ( is_loose() ) return loose_intersects( n, obj );
+
+        return detail::intersects< detail::has_width_member< Obj_type >::value, point_data_type >()( n.bounds, obj );
+    }
+
+    /**
+     * The children of n (which has some) whose loosened bounds overlap obj,
+     * as a bitmask as for detail::intersects.
+     */
+    template< typename Obj_type >
+    int loose_intersects( const node & n, const Obj_type & obj ) const
+    {
+        const detail::box< point_data_type > b = detail::bounding_box< detail::has_width_member< Obj_type >::value, point_data_type >()( obj );
+
+        int result = 0;
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            const rectangle_type r = loosen( m_nodes[ n.first_child + i ].bounds );
+
+            if ( b.min_x <= r.x() + r.width() && b.max_x >= r.x() && b.min_y <= r.y() + r.height() && b.max_y >= r.y() )
+                result |= 1 << i;
+        }
+
+        return result;
+    }
+
+    static void split( node_pool & nodes, node_handle h )
+    {
+        split( nodes, h, nodes.size() );
+    }
+
+    // as above, placing the children at first, which is either the end of
+    // the pool or a block of four released by merge
+    static void split( node_pool & nodes, node_handle h, node_handle first )
+    {
+        const rectangle_type bounds = nodes[ h ].bounds;
+        const size_type level = nodes[ h ].level + 1;
+
+        point_data_type half_width = bounds.width() / 2;
+        point_data_type half_height = bounds.height() / 2;
+
+        const node children[ 4 ] = {
+            node( rectangle_type( bounds.x(), bounds.y(), half_width, half_height ), level, h ),
+            node( rectangle_type( bounds.x() + half_width, bounds.y(), half_width, half_height ), level, h ),
+            node( rectangle_type( bounds.x() + half_width, bounds.y() + half_height, half_width, half_height ), level, h ),
+            node( rectangle_type( bounds.x(), bounds.y() + half_height, half_width, half_height ), level, h ) };
+
+        if ( first == node_handle( nodes.size() ))
+            nodes.insert( nodes.end(), children, children + 4 );
+        else
+            std::copy( children, children + 4, nodes.begin() + first );
+
+        nodes[ h ].first_child = first;
+    }
+
+    void split( node_handle h )
+    {
+        if ( m_free_blocks.empty() )
+        {
+            split( m_nodes, h );
+        }
+        else
+        {
+            split( m_nodes, h, m_free_blocks.back() );
+            m_free_blocks.pop_back();
+        }
+    }
+
+    // bulk loading
+
+    typedef detail::bulk_key_array                      key_array;
+    typedef std::pair< std::uint64_t, size_type >       keyed_offset;
+    typedef std::vector< keyed_offset >                 keyed_offset_array;
+
+    // number of levels which fit into a single 64 bit cell key
+    enum { max_key_levels = 31 };
+
+    /**
+     * Computes the cell key of an object's centre, relative to the given
+     * bounds. Each level contributes two bits (the quadrant index, as used
+     * by split()), most significant first, so sorting by key groups the
+     * objects of every node's subtree into one contiguous run.
+     */
+    template< typename Obj_type >
+    static std::uint64_t cell_key( const rectangle_type & bounds, const Obj_type & obj, int levels )
+    {
+        const point_type c = detail::centre< detail::has_width_member< Obj_type >::value, point_data_type >()( obj );
+
+        point_data_type x = bounds.x();
+        point_data_type y = bounds.y();
+        point_data_type w = bounds.width();
+        point_data_type h = bounds.height();
+
+        // quadrant index for ( right | top << 1 ), matching detail::index
+        static const std::uint64_t quadrant[ 4 ] = { 0, 1, 3, 2 };
+
+        std::uint64_t key = 0;
+
+        for ( int i = 0; i < levels; ++i )
+        {
+            w = w / 2;
+            h = h / 2;
+
+            const int right = c.x() >= x + w;
+            const int top = c.y() >= y + h;
+
+            // written to be branch-free, the quadrant of a centre is close to random
+            x += right * w;
+            y += top * h;
+
+            key = ( key << 2 ) | quadrant[ right | ( top << 1 ) ];
+        }
+
+        return key;
+    }
+
+    /**
+     * Computes the keys of the run [b, e) relative to node n, and reorders
+     * both the keys and the objects of the run into key order.
+     */
+    static void sort_run( const node & n, container_type & objects, key_array & keys, size_type b, size_type e, int key_levels )
+    {
+        detail::sort_run( objects, keys, b, e, 2 * key_levels,
+            [&n, key_levels]( const T & obj ) { return cell_key( n.bounds, obj, key_levels ); } );
+    }
+
+    /**
+     * Builds the subtree rooted at h (within the given pool) from the run
+     * [b, e) of the staged objects and their keys. key_level is the level
+     * (relative to the last keying) at which the quadrant is read from a key,
+     * key_levels the number of levels that the current keys hold. Should the
+     * tree be deeper than a key can describe, the remaining run is re-keyed
+     * relative to the current node.
+     */
+    void build( node_pool & nodes, node_handle h, container_type & objects, key_array & keys, size_type b, size_type e, int key_level, int key_levels ) const
+    {
+        const size_type count = e - b;
+
+        if ( count <= m_max_objects || nodes[ h ].level >= m_max_levels )
+        {
+            nodes[ h ].objects.assign( objects.begin() + b, objects.begin() + e );
+            return;
+        }
+
+        if ( key_level == key_levels )
+        {
+            key_level = 0;
+            key_levels = std::min< int >( max_key_levels, m_max_levels - nodes[ h ].level );
+
+            sort_run( nodes[ h ], objects, keys, b, e, key_levels );
+        }
+
+        split( nodes, h );
+
+        // objects which straddle a midline stay here, the rest keep their
+        // (sorted) order and are handed down to the children
+        node & n = nodes[ h ];
+
+        const size_type kept = detail::hand_down( objects, keys, b, e,
+            [this, &n]( const T & obj ) { return index( n, obj ) == npos; },
+            [&n]( const T & obj ) { n.objects.push_back( obj ); } );
+
+        const int shift = 2 * ( key_levels - key_level - 1 );
+        const node_handle first_child = n.first_child;
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            const size_type child_end = detail::child_run_end( keys, b, kept, shift, 2, i );
+
+            build( nodes, first_child + i, objects, keys, b, child_end, key_level + 1, key_levels );
+
+            b = child_end;
+        }
+    }
+
+    // parallel bulk loading
+
+    /**
+     * A subtree which is left for a worker thread to build: the node at
+     * which it is rooted, and its run of the staged objects.
+     */
+    struct build_task
+    {
+        node_handle             h;
+        size_type               b;
+        size_type               e;
+    };
+
+    typedef std::vector< build_task >                   build_task_array;
+
+    typedef std::array< size_type, 5 >                  quadrant_offsets;
+
+    /**
+     * Partitions the run of an already split node by child quadrant. Objects
+     * which straddle a midline are moved into the node itself; the rest are
+     * grouped by quadrant within the run, with child i receiving the range
+     * [b + offsets[i], b + offsets[i+1]).
+     */
+    void partition( const build_task & task, container_type & objects, quadrant_offsets & offsets )
+    {
+        node & n = m_nodes[ task.h ];
+
+        std::vector< int > quadrants( task.e - task.b );
+        offsets.fill( 0 );
+
+        for ( size_type i = task.b; i != task.e; ++i )
+        {
+            int idx = index( n, objects[ i ] );
+
+            if ( idx == npos )
+                n.objects.push_back( objects[ i ] );
+            else
+                ++offsets[ idx + 1 ];
+
+            quadrants[ i - task.b ] = idx;
+        }
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            offsets[ i + 1 ] += offsets[ i ];
+        }
+
+        // (the scatter target is initialised by copy, as T need not be default
+        // constructible, and every element is then overwritten)
+        container_type partitioned( objects.begin() + task.b, objects.begin() + task.b + offsets[ 4 ] );
+        quadrant_offsets positions( offsets );
+
+        for ( size_type i = task.b; i != task.e; ++i )
+        {
+            if ( quadrants[ i - task.b ] != npos )
+                partitioned[ positions[ quadrants[ i - task.b ]]++ ] = objects[ i ];
+        }
+
+        std::copy( partitioned.begin(), partitioned.end(), objects.begin() + task.b );
+    }
+
+    /**
+     * Builds the subtree of a task into a pool of its own. The task's node is
+     * copied as the root (handle 0) of the local pool.
+     */
+    void build_subtree( const build_task & task, container_type & objects, key_array & keys, node_pool & local ) const
+    {
+        local.push_back( node( m_nodes[ task.h ].bounds, m_nodes[ task.h ].level, npos ));
+
+        build( local, root, objects, keys, task.b, task.e, 0, 0 );
+    }
+
+    /**
+     * Appends a subtree built in a local pool to this tree's pool, in place
+     * of the task node h. The local root maps onto h, while every other local
+     * node keeps its relative position, so blocks of children stay contiguous.
+     */
+    void splice( node_handle h, node_pool & local )
+    {
+        const node_handle base = m_nodes.size() - 1;
+
+        auto map = [h, base]( node_handle l ) { return l == npos ? npos : l == root ? h : base + l; };
+
+        m_nodes[ h ].objects.swap( local[ root ].objects );
+        m_nodes[ h ].first_child = map( local[ root ].first_child );
+
+        for ( size_type i = 1; i < local.size(); ++i )
+        {
+            node & n = local[ i ];
+
+            n.parent = map( n.parent );
+            n.first_child = map( n.first_child );
+
+            m_nodes.push_back( std::move( n ));
+        }
+    }
+
+    /**
+     * Builds the levels above the cutoff one level at a time: the nodes to be
+     * split are split first (the only step which grows the pool), then their
+     * runs are partitioned concurrently. The independent subtrees found at
+     * the cutoff are then built concurrently, each into a pool of its own.
+     * Every worker writes only to its own run of the staged objects and to
+     * its own node or pool, so no further synchronisation is required.
+     */
+    void parallel_build( container_type & objects, unsigned threads, size_type cutoff_level )
+    {
+        key_array keys( objects.size() );
+        build_task_array frontier( 1, build_task{ root, 0, size_type( objects.size() ) } );
+        build_task_array splits;
+        build_task_array tasks;
+
+        while ( !frontier.empty() )
+        {
+            splits.clear();
+
+            for ( const build_task & task : frontier )
+            {
+                if ( task.e - task.b <= m_max_objects || m_nodes[ task.h ].level >= m_max_levels )
+                {
+                    m_nodes[ task.h ].objects.assign( objects.begin() + task.b, objects.begin() + task.e );
+                }
+                else if ( m_nodes[ task.h ].level >= cutoff_level )
+                {
+                    tasks.push_back( task );
+                }
+                else
+                {
+                    split( m_nodes, task.h );
+                    splits.push_back( task );
+                }
+            }
+
+            std::vector< quadrant_offsets > offsets( splits.size() );
+
+            detail::parallel_for( splits.size(), threads, [&]( size_type i ) { partition( splits[ i ], objects, offsets[ i ] ); } );
+
+            frontier.clear();
+
+            for ( size_type i = 0; i < splits.size(); ++i )
+            {
+                const build_task & task = splits[ i ];
+
+                for ( int q = 0; q < 4; ++q )
+                {
+                    build_task child = { m_nodes[ task.h ].first_child + q, task.b + offsets[ i ][ q ], task.b + offsets[ i ][ q + 1 ] };
+                    frontier.push_back( child );
+                }
+            }
+        }
+
+        std::vector< node_pool > pools( tasks.size() );
+
+        detail::parallel_for( tasks.size(), threads, [&]( size_type i ) { build_subtree( tasks[ i ], objects, keys, pools[ i ] ); } );
+
+        for ( size_type i = 0; i < tasks.size(); ++i )
+        {
+            splice( tasks[ i ].h, pools[ i ] );
+        }
+    }
+
+private:
+    size_type                   m_max_levels;
+    size_type                   m_max_objects;
+    double                      m_looseness;
+    node_pool                   m_nodes;
+    std::vector< node_handle >  m_free_blocks;
+};
+
+/**
+ * @brief Output stream operator specialised for quad_tree types.
+ */
+template< typename T, typename Instrument, typename Nodes >
+std::ostream & operator<<( std::ostream & os, const quad_tree< T, Instrument, Nodes > & q )
+{
+    os << "<quadtree id:" << q.id() << ">";
+    return os;
+}
+
+/**
+ * loose_quad_tree is a quad_tree whose nodes each hold the objects lying
+ * within their bounds grown by a looseness factor about their centre.
+ * Objects are placed by their centre and size, rather than by whether they
+ * straddle a midline, so those crossing the centre lines of a node no
+ * longer stay in that node (and are returned by every query reaching it);
+ * in exchange, queries test against the grown bounds, so visit more nodes.
+ * It is a quad_tree with the loose_nodes policy, the looseness factor being
+ * given at construction.
+ */
+template< typename T, typename Instrument = no_instrumentation >
+class loose_quad_tree : public quad_tree< T, Instrument, loose_nodes >
+{
+public:
+
+    typedef typename quad_tree< T, Instrument, loose_nodes >::rectangle_type    rectangle_type;
+
+    loose_quad_tree( const rectangle_type & bounds, int max_levels, int max_objects, double looseness = 2.0 )
+
+        : quad_tree< T, Instrument, loose_nodes >( looseness, bounds, max_levels, max_objects )
+    {}
+
+    /**
+     * @brief Bulk-load constructor (see quad_tree)
+     */
+    template< typename Input_iterator >
+    loose_quad_tree( const rectangle_type & bounds, int max_levels, int max_objects,
+                     Input_iterator first, Input_iterator last, double looseness = 2.0 )
+
+        : quad_tree< T, Instrument, loose_nodes >( looseness, bounds, max_levels, max_objects, first, last )
+    {}
+};
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /*
+     * quad_tree helper functions, which operate on either rectangular data
+     * structures or point data structures
+     */
+
+    /**
+     * @brief index
+     *
+     * Locate the quad node index of a rectangle, or -1 if the recangle
+     * doesn't fully fit into one quad.
+     */
+    template<typename Data_type>
+    struct index<RECTANGLE_TYPE, Data_type>
+    {
+        template< typename Bounds_type, typename Rect_type >
+        int operator()( const Bounds_type & b, const Rect_type & r ) const
+        {
+            int result = npos;
+
+            Data_type x_midpoint = b.x() + b.width() / 2;
+            Data_type y_midpoint = b.y() + b.height() / 2;
+
+            bool bottom_half = r.y() < y_midpoint && r.y() + r.height() < y_midpoint;
+            bool top_half = r.y() >= y_midpoint;
+
+            // fits in left half:
+            if ( ( r.x() < x_midpoint ) && ( r.x() + r.width() < x_midpoint ) )
+            {
+                if ( top_half )         result = 3;
+                else if ( bottom_half ) result = 0;
+            }
+            // fits in right half:
+            else if ( r.x() >= x_midpoint )
+            {
+                if ( top_half )         result = 2;
+                else if ( bottom_half ) result = 1;
+            }
+
+            return result;
+        }
+
+    };
+
+    /**
+     * @brief intersects
+     *
+     * Locate all the indices of quads which are intersected by the supplied shape
+     */
+    template< typename Data_type >
+    struct intersects<RECTANGLE_TYPE, Data_type>
+    {
+        template< typename Bounds_type, typename Rect_type >
+        int operator()( const Bounds_type & b, const Rect_type & r ) const
+        {
+            const std::array< point< Data_type >, 4 > corners = rectangle_corners( r );
+
+            int result = 0;
 
             for ( const auto & p : corners )
             {
-                int idx = q->index( p );
+                int idx = index< POINT_TYPE, Data_type >()( b, p );
 
-                if ( idx != quad_tree<T>::npos ) result |= (1<<idx);
+                if ( idx != npos ) result |= (1<<idx);
             }
 
             return result;
@@ -616,13 +1987,13 @@ namespace detail
     template<typename Data_type>
     struct index<POINT_TYPE, Data_type>
     {
-        template< typename T, typename Point_type >
-        int operator()( const quad_tree<T> * q, const Point_type & p ) const
+        template< typename Bounds_type, typename Point_type >
+        int operator()( const Bounds_type & b, const Point_type & p ) const
         {
-            int result = quad_tree<T>::npos;
+            int result = npos;
 
-            Data_type x_midpoint = q->m_bounds.x() + q->m_bounds.width() / 2;
-            Data_type y_midpoint = q->m_bounds.y() + q->m_bounds.height() / 2;
+            Data_type x_midpoint = b.x() + b.width() / 2;
+            Data_type y_midpoint = b.y() + b.height() / 2;
 
             bool bottom_half = p.y() < y_midpoint;
             bool top_half = p.y() >= y_midpoint;
@@ -648,6 +2019,68 @@ namespace detail
         }
     };
 
+    /**
+     * @brief centre
+     *
+     * The centre of a rectangle's bounding box.
+     */
+    template< typename Data_type >
+    struct centre<RECTANGLE_TYPE, Data_type>
+    {
+        template< typename Rect_type >
+        point< Data_type > operator()( const Rect_type & r ) const
+        {
+            return point< Data_type >( r.x() + r.width() / 2, r.y() + r.height() / 2 );
+        }
+    };
+
+    /**
+     * @brief centre
+     *
+     * A point is its own centre.
+     */
+    template< typename Data_type >
+    struct centre<POINT_TYPE, Data_type>
+    {
+        template< typename Point_type >
+        point< Data_type > operator()( const Point_type & p ) const
+        {
+            return point< Data_type >( p.x(), p.y() );
+        }
+    };
+
+    /**
+     * @brief bounding_box
+     *
+     * The (closed) bounding box of a rectangle.
+     */
+    template< typename Data_type >
+    struct bounding_box<RECTANGLE_TYPE, Data_type>
+    {
+        template< typename Rect_type >
+        box< Data_type > operator()( const Rect_type & r ) const
+        {
+            box< Data_type > b = { r.x(), r.y(), r.x() + r.width(), r.y() + r.height() };
+            return b;
+        }
+    };
+
+    /**
+     * @brief bounding_box
+     *
+     * The bounding box of a point, which has no extent.
+     */
+    template< typename Data_type >
+    struct bounding_box<POINT_TYPE, Data_type>
+    {
+        template< typename Point_type >
+        box< Data_type > operator()( const Point_type & p ) const
+        {
+            box< Data_type > b = { p.x(), p.y(), p.x(), p.y() };
+            return b;
+        }
+    };
+
     /**
      * @brief intersects
      *
@@ -659,14 +2092,14 @@ namespace detail
     template< typename Data_type >
     struct intersects<POINT_TYPE, Data_type>
     {
-        template< typename T, typename Point_type >
-        int operator()( const quad_tree<T> * q, const Point_type & p ) const
+        template< typename Bounds_type, typename Point_type >
+        int operator()( const Bounds_type & b, const Point_type & p ) const
         {
             int result = 0;
 
-            int idx = q->index( p );
+            int idx = index< POINT_TYPE, Data_type >()( b, p );
 
-            if ( idx != quad_tree<T>::npos ) result |= (1<<idx);
+            if ( idx != npos ) result |= (1<<idx);
 
             return result;
         }
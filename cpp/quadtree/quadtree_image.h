@@ -0,0 +1,67 @@
+#ifndef QUADTREE_QUADTREE_IMAGE_H
+#define QUADTREE_QUADTREE_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * The layout of a quad_tree image, as written by quad_tree::save and
+     * read in place by quad_tree_view. An image is a header, followed by
+     * the nodes (in pool order) at nodes_offset and the objects at
+     * objects_offset. Nodes refer to their children and objects by index,
+     * so the image holds no pointers and can be mapped at any address.
+     *
+     * Values are stored in the writer's native representation: an image
+     * is only readable by a build with the same object and coordinate
+     * types, which the header records. loose records the node policy of
+     * the tree saved (1 for loose_nodes), which decides how its objects
+     * were placed, whatever its looseness.
+     */
+    struct image_header
+    {
+        enum : std::uint32_t { current_version = 2 };
+
+        char            magic[ 8 ];
+        std::uint32_t   version;
+        std::uint32_t   value_size;
+        std::uint32_t   coordinate_size;
+        std::uint32_t   node_count;
+        std::uint32_t   loose;
+        std::uint32_t   reserved;       // zero
+        std::uint64_t   object_count;
+        std::uint64_t   nodes_offset;
+        std::uint64_t   objects_offset;
+        double          looseness;
+    };
+
+    static const char image_magic[ 8 ] = { 'Q', 'T', 'I', 'M', 'A', 'G', 'E', '\0' };
+
+    /**
+     * A node of an image: its bounds, the region its objects may occupy
+     * (its bounds loosened, in a loose tree), its first child (npos for a
+     * leaf; the four are consecutive, as in the pool) and its objects,
+     * [first_object, first_object + object_count) of the image's objects.
+     */
+    template< typename Data_type >
+    struct image_node
+    {
+        Data_type       bounds[ 4 ];
+        Data_type       query_bounds[ 4 ];
+        std::int32_t    first_child;
+        std::uint32_t   object_count;
+        std::uint64_t   first_object;
+    };
+
+    // offsets within an image are kept aligned for any of its members
+    inline std::uint64_t image_align( std::uint64_t offset )
+    {
+        return ( offset + 15 ) & ~std::uint64_t( 15 );
+    }
+}
+
+#endif // QUADTREE_QUADTREE_IMAGE_H
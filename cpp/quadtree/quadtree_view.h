@@ -0,0 +1,306 @@
+#ifndef QUADTREE_QUADTREE_VIEW_H
+#define QUADTREE_QUADTREE_VIEW_H
+
+#include "quadtree.h"
+#include "quadtree_image.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ *
+ * quad_tree_view answers queries directly from an image written by
+ * quad_tree::save, mapped read-only into memory: nothing is built when it
+ * is opened, the objects are only faulted in as queries reach them, and
+ * every process mapping the same file shares one page-cached copy. Only
+ * the nodes are read when it is opened, once, to check that every index
+ * they hold lies within the image.
+ *
+ * The queries give the same results, in the same order, as those of the
+ * quad_tree which was saved.
+ *
+ */
+template< typename T >
+class quad_tree_view
+{
+    static const int npos = detail::npos;
+
+    typedef decltype(((T*)nullptr)->x())                point_data_type;
+    typedef detail::image_node< point_data_type >       node;
+
+public:
+
+    typedef T                                           value_type;
+    typedef point< point_data_type >                    point_type;
+    typedef line_segment< point_data_type >             line_type;
+    typedef rectangle< point_data_type >                rectangle_type;
+    typedef unsigned                                    size_type;
+
+    /**
+     * @brief open
+     *
+     * Maps the image at path. Throws std::runtime_error if it cannot be
+     * mapped, is not an image of this object type, or is truncated or
+     * corrupt (a node referring to children or objects beyond the image,
+     * or to a block of children another node refers to).
+     */
+    static quad_tree_view open( const std::string & path )
+    {
+        static_assert( std::is_trivially_copyable< T >::value, "quad_tree_view requires trivially copyable objects" );
+
+        const int fd = ::open( path.c_str(), O_RDONLY );
+
+        if ( fd < 0 ) throw std::runtime_error( "quad_tree_view: cannot open " + path );
+
+        struct stat st;
+        void * image = MAP_FAILED;
+
+        if ( ::fstat( fd, &st ) == 0 && std::size_t( st.st_size ) >= sizeof( detail::image_header ))
+            image = ::mmap( nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+
+        // the mapping holds its own reference to the file
+        ::close( fd );
+
+        if ( image == MAP_FAILED ) throw std::runtime_error( "quad_tree_view: cannot map " + path );
+
+        quad_tree_view view( static_cast< const char * >( image ), st.st_size );
+
+        if ( !view.valid_header() ) throw std::runtime_error( "quad_tree_view: " + path + " is not an image of this object type" );
+
+        view.m_nodes = reinterpret_cast< const node * >( view.m_image + view.m_header->nodes_offset );
+        view.m_objects = reinterpret_cast< const T * >( view.m_image + view.m_header->objects_offset );
+
+        if ( !view.valid_nodes() ) throw std::runtime_error( "quad_tree_view: " + path + " is corrupt" );
+
+        return view;
+    }
+
+    quad_tree_view( quad_tree_view && other )
+
+        : m_image( other.m_image )
+        , m_length( other.m_length )
+        , m_header( other.m_header )
+        , m_nodes( other.m_nodes )
+        , m_objects( other.m_objects )
+    {
+        other.m_image = nullptr;
+    }
+
+    ~quad_tree_view()
+    {
+        if ( m_image )
+            ::munmap( const_cast< char * >( m_image ), m_length );
+    }
+
+    quad_tree_view( const quad_tree_view & ) = delete;
+    quad_tree_view & operator=( const quad_tree_view & ) = delete;
+
+    rectangle_type bounds() const
+    {
+        return rectangle_of( m_nodes[ root ].bounds );
+    }
+
+    size_type size() const
+    {
+        return size_type( m_header->object_count );
+    }
+
+    size_type node_count() const
+    {
+        return m_header->node_count;
+    }
+
+    /**
+     * @brief for_each_match
+     *
+     * As quad_tree::for_each_match.
+     */
+    template< typename Object_type, typename Functor_type >
+    void for_each_match( const Object_type & r, const Functor_type & f ) const
+    {
+        for_each_match( root, r, f );
+    }
+
+    /**
+     * @brief line_intersect
+     *
+     * As quad_tree::line_intersect.
+     */
+    template< typename Functor_type >
+    void line_intersect( const line_type & l, const Functor_type & f ) const
+    {
+        line_intersect( root, l, f );
+    }
+
+private:
+
+    enum { root = 0 };
+
+    quad_tree_view( const char * image, std::size_t length )
+
+        : m_image( image )
+        , m_length( length )
+        , m_header( reinterpret_cast< const detail::image_header * >( image ))
+        , m_nodes( nullptr )
+        , m_objects( nullptr )
+    {
+    }
+
+    /**
+     * Whether the header is that of an image of this object type, whose
+     * nodes and objects lie within the mapping. The sizes are compared by
+     * division, so that no count, however large, can overflow.
+     */
+    bool valid_header() const
+    {
+        const detail::image_header & h = *m_header;
+
+        return std::memcmp( h.magic, detail::image_magic, sizeof( h.magic )) == 0 &&
+               h.version == detail::image_header::current_version &&
+               h.value_size == sizeof( T ) && h.coordinate_size == sizeof( point_data_type ) &&
+               h.node_count > 0 && h.loose <= 1 &&
+               h.nodes_offset >= sizeof( h ) && h.nodes_offset % alignof( node ) == 0 &&
+               h.objects_offset >= h.nodes_offset && h.objects_offset <= m_length && h.objects_offset % alignof( T ) == 0 &&
+               h.node_count <= ( h.objects_offset - h.nodes_offset ) / sizeof( node ) &&
+               h.object_count <= ( m_length - h.objects_offset ) / sizeof( T );
+    }
+
+    /**
+     * Whether every node's children and objects lie within the image, and
+     * no block of children is shared or holds the root, so that the queries
+     * neither read beyond the image nor revisit a node.
+     */
+    bool valid_nodes() const
+    {
+        const std::uint64_t node_count = m_header->node_count;
+        const std::uint64_t object_count = m_header->object_count;
+
+        std::vector< bool > is_child( node_count );
+
+        for ( std::uint64_t i = 0; i < node_count; ++i )
+        {
+            const node & n = m_nodes[ i ];
+
+            if ( n.first_object > object_count || n.object_count > object_count - n.first_object ) return false;
+
+            if ( n.first_child == npos ) continue;
+
+            if ( n.first_child <= root || std::uint64_t( n.first_child ) + 4 > node_count ) return false;
+
+            for ( int c = 0; c < 4; ++c )
+            {
+                if ( is_child[ n.first_child + c ] ) return false;
+
+                is_child[ n.first_child + c ] = true;
+            }
+        }
+
+        return true;
+    }
+
+    static rectangle_type rectangle_of( const point_data_type ( & r )[ 4 ] )
+    {
+        return rectangle_type( r[ 0 ], r[ 1 ], r[ 2 ], r[ 3 ] );
+    }
+
+    // from the node policy recorded, as a loose tree's looseness may be 1
+    bool is_loose() const
+    {
+        return m_header->loose != 0;
+    }
+
+    // as quad_tree::intersects, from the bounds the image holds
+    template< typename Obj_type >
+    int intersects( const node & n, const Obj_type & obj ) const
+    {
+        if ( !is_loose() )
+            return detail::intersects< detail::has_width_member< Obj_type >::value, point_data_type >()( rectangle_of( n.bounds ), obj );
+
+        const detail::box< point_data_type > b = detail::bounding_box< detail::has_width_member< Obj_type >::value, point_data_type >()( obj );
+
+        int result = 0;
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            const point_data_type * r = m_nodes[ n.first_child + i ].query_bounds;
+
+            if ( b.min_x <= r[ 0 ] + r[ 2 ] && b.max_x >= r[ 0 ] && b.min_y <= r[ 1 ] + r[ 3 ] && b.max_y >= r[ 1 ] )
+                result |= 1 << i;
+        }
+
+        return result;
+    }
+
+    template< typename Object_type, typename Functor_type >
+    void for_each_match( int h, const Object_type & r, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( n.first_child != npos )
+        {
+            int indices = intersects( n, r );
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                if ( indices & (1<<i) )
+                {
+                    for_each_match( n.first_child + i, r, f );
+                }
+            }
+        }
+
+        for_each_object( n, f );
+    }
+
+    template< typename Functor_type >
+    void line_intersect( int h, const line_type & l, const Functor_type & f ) const
+    {
+        const node & n = m_nodes[ h ];
+
+        if ( has_intersect( l, rectangle_of( n.query_bounds )))
+        {
+            if ( n.first_child != npos )
+            {
+                // the same order as quad_tree::front_to_back
+                static const int order[ 4 ][ 4 ] = { { 0, 1, 3, 2 }, { 1, 0, 2, 3 }, { 3, 0, 2, 1 }, { 2, 1, 3, 0 } };
+
+                const int * o = order[ ( l.p2().x() < l.p1().x() ) | ( l.p2().y() < l.p1().y() ) << 1 ];
+
+                for ( int i = 0; i < 4; ++i )
+                {
+                    line_intersect( n.first_child + o[ i ], l, f );
+                }
+            }
+
+            for_each_object( n, f );
+        }
+    }
+
+    template< typename Functor_type >
+    void for_each_object( const node & n, const Functor_type & f ) const
+    {
+        const T * first = m_objects + n.first_object;
+
+        for ( const T * obj = first; obj != first + n.object_count; ++obj )
+        {
+            f( *obj );
+        }
+    }
+
+    const char *                    m_image;
+    std::size_t                     m_length;
+    const detail::image_header *    m_header;
+    const node *                    m_nodes;
+    const T *                       m_objects;
+};
+
+#endif // QUADTREE_QUADTREE_VIEW_H
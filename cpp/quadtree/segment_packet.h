@@ -0,0 +1,312 @@
+#ifndef QUADTREE_SEGMENT_PACKET_H
+#define QUADTREE_SEGMENT_PACKET_H
+
+#include "geom.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#if defined( __AVX__ )
+#include <immintrin.h>
+#endif
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * The arrays of a segment packet, each n lanes long, in the order below.
+     */
+    enum { lane_px, lane_py, lane_dx, lane_dy, lane_min_x, lane_min_y, lane_max_x, lane_max_y, lane_arrays };
+
+    /**
+     * @brief lane_touches
+     *
+     * Tests lane i of a segment packet against the rectangle [x0, x1] x
+     * [y0, y1], exactly as has_intersect( line_segment, rectangle ) does.
+     */
+    template< typename Data_type >
+    bool lane_touches( const Data_type * lanes, int n, int i,
+                       const Data_type & x0, const Data_type & y0, const Data_type & x1, const Data_type & y1 )
+    {
+        const Data_type px = lanes[ lane_px * n + i ];
+        const Data_type py = lanes[ lane_py * n + i ];
+        const Data_type dx = lanes[ lane_dx * n + i ];
+        const Data_type dy = lanes[ lane_dy * n + i ];
+
+        const Data_type centre = dy * ( x0 + x1 - 2 * px ) - dx * ( y0 + y1 - 2 * py );
+        const Data_type spread = std::abs( dy ) * ( x1 - x0 ) + std::abs( dx ) * ( y1 - y0 );
+
+        return ( lanes[ lane_max_x * n + i ] >= x0 ) & ( lanes[ lane_min_x * n + i ] <= x1 ) &
+               ( lanes[ lane_max_y * n + i ] >= y0 ) & ( lanes[ lane_min_y * n + i ] <= y1 ) &
+               ( std::abs( centre ) <= spread );
+    }
+
+    /**
+     * @brief packet_touches
+     *
+     * Tests every lane of a segment packet against a rectangle.
+     *
+     * @return A bitmask with bit i set if segment i touches the rectangle.
+     */
+    template< typename Data_type >
+    struct packet_touches
+    {
+        unsigned operator()( const Data_type * lanes, int n,
+                             const Data_type & x0, const Data_type & y0, const Data_type & x1, const Data_type & y1 ) const
+        {
+            unsigned mask = 0;
+
+            for ( int i = 0; i < n; ++i )
+            {
+                mask |= unsigned( lane_touches( lanes, n, i, x0, y0, x1, y1 )) << i;
+            }
+
+            return mask;
+        }
+    };
+
+#if defined( __SSE2__ )
+
+    template<>
+    struct packet_touches< float >
+    {
+        unsigned operator()( const float * lanes, int n,
+                             const float & x0, const float & y0, const float & x1, const float & y1 ) const
+        {
+            const __m128 sign = _mm_set1_ps( -0.0f );
+            const __m128 vx0 = _mm_set1_ps( x0 );
+            const __m128 vy0 = _mm_set1_ps( y0 );
+            const __m128 vx1 = _mm_set1_ps( x1 );
+            const __m128 vy1 = _mm_set1_ps( y1 );
+            const __m128 cx = _mm_set1_ps( x0 + x1 );
+            const __m128 cy = _mm_set1_ps( y0 + y1 );
+            const __m128 w = _mm_set1_ps( x1 - x0 );
+            const __m128 h = _mm_set1_ps( y1 - y0 );
+
+            unsigned mask = 0;
+            int i = 0;
+
+            for ( ; i + 4 <= n; i += 4 )
+            {
+                __m128 px = _mm_loadu_ps( lanes + lane_px * n + i );
+                __m128 py = _mm_loadu_ps( lanes + lane_py * n + i );
+                __m128 dx = _mm_loadu_ps( lanes + lane_dx * n + i );
+                __m128 dy = _mm_loadu_ps( lanes + lane_dy * n + i );
+
+                __m128 centre = _mm_sub_ps( _mm_mul_ps( dy, _mm_sub_ps( cx, _mm_add_ps( px, px ))),
+                                            _mm_mul_ps( dx, _mm_sub_ps( cy, _mm_add_ps( py, py ))));
+                __m128 spread = _mm_add_ps( _mm_mul_ps( _mm_andnot_ps( sign, dy ), w ),
+                                            _mm_mul_ps( _mm_andnot_ps( sign, dx ), h ));
+
+                __m128 hit = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( _mm_loadu_ps( lanes + lane_max_x * n + i ), vx0 ),
+                                                     _mm_cmple_ps( _mm_loadu_ps( lanes + lane_min_x * n + i ), vx1 )),
+                                         _mm_and_ps( _mm_cmpge_ps( _mm_loadu_ps( lanes + lane_max_y * n + i ), vy0 ),
+                                                     _mm_cmple_ps( _mm_loadu_ps( lanes + lane_min_y * n + i ), vy1 )));
+
+                hit = _mm_and_ps( hit, _mm_cmple_ps( _mm_andnot_ps( sign, centre ), spread ));
+
+                mask |= unsigned( _mm_movemask_ps( hit )) << i;
+            }
+
+            for ( ; i < n; ++i )
+            {
+                mask |= unsigned( lane_touches( lanes, n, i, x0, y0, x1, y1 )) << i;
+            }
+
+            return mask;
+        }
+    };
+
+#endif
+
+#if defined( __SSE2__ ) && !defined( __AVX__ )
+
+    template<>
+    struct packet_touches< double >
+    {
+        unsigned operator()( const double * lanes, int n,
+                             const double & x0, const double & y0, const double & x1, const double & y1 ) const
+        {
+            const __m128d sign = _mm_set1_pd( -0.0 );
+            const __m128d vx0 = _mm_set1_pd( x0 );
+            const __m128d vy0 = _mm_set1_pd( y0 );
+            const __m128d vx1 = _mm_set1_pd( x1 );
+            const __m128d vy1 = _mm_set1_pd( y1 );
+            const __m128d cx = _mm_set1_pd( x0 + x1 );
+            const __m128d cy = _mm_set1_pd( y0 + y1 );
+            const __m128d w = _mm_set1_pd( x1 - x0 );
+            const __m128d h = _mm_set1_pd( y1 - y0 );
+
+            unsigned mask = 0;
+            int i = 0;
+
+            for ( ; i + 2 <= n; i += 2 )
+            {
+                __m128d px = _mm_loadu_pd( lanes + lane_px * n + i );
+                __m128d py = _mm_loadu_pd( lanes + lane_py * n + i );
+                __m128d dx = _mm_loadu_pd( lanes + lane_dx * n + i );
+                __m128d dy = _mm_loadu_pd( lanes + lane_dy * n + i );
+
+                __m128d centre = _mm_sub_pd( _mm_mul_pd( dy, _mm_sub_pd( cx, _mm_add_pd( px, px ))),
+                                             _mm_mul_pd( dx, _mm_sub_pd( cy, _mm_add_pd( py, py ))));
+                __m128d spread = _mm_add_pd( _mm_mul_pd( _mm_andnot_pd( sign, dy ), w ),
+                                             _mm_mul_pd( _mm_andnot_pd( sign, dx ), h ));
+
+                __m128d hit = _mm_and_pd( _mm_and_pd( _mm_cmpge_pd( _mm_loadu_pd( lanes + lane_max_x * n + i ), vx0 ),
+                                                      _mm_cmple_pd( _mm_loadu_pd( lanes + lane_min_x * n + i ), vx1 )),
+                                          _mm_and_pd( _mm_cmpge_pd( _mm_loadu_pd( lanes + lane_max_y * n + i ), vy0 ),
+                                                      _mm_cmple_pd( _mm_loadu_pd( lanes + lane_min_y * n + i ), vy1 )));
+
+                hit = _mm_and_pd( hit, _mm_cmple_pd( _mm_andnot_pd( sign, centre ), spread ));
+
+                mask |= unsigned( _mm_movemask_pd( hit )) << i;
+            }
+
+            for ( ; i < n; ++i )
+            {
+                mask |= unsigned( lane_touches( lanes, n, i, x0, y0, x1, y1 )) << i;
+            }
+
+            return mask;
+        }
+    };
+
+#endif
+
+#if defined( __AVX__ )
+
+    template<>
+    struct packet_touches< double >
+    {
+        unsigned operator()( const double * lanes, int n,
+                             const double & x0, const double & y0, const double & x1, const double & y1 ) const
+        {
+            const __m256d sign = _mm256_set1_pd( -0.0 );
+            const __m256d vx0 = _mm256_set1_pd( x0 );
+            const __m256d vy0 = _mm256_set1_pd( y0 );
+            const __m256d vx1 = _mm256_set1_pd( x1 );
+            const __m256d vy1 = _mm256_set1_pd( y1 );
+            const __m256d cx = _mm256_set1_pd( x0 + x1 );
+            const __m256d cy = _mm256_set1_pd( y0 + y1 );
+            const __m256d w = _mm256_set1_pd( x1 - x0 );
+            const __m256d h = _mm256_set1_pd( y1 - y0 );
+
+            unsigned mask = 0;
+            int i = 0;
+
+            for ( ; i + 4 <= n; i += 4 )
+            {
+                __m256d px = _mm256_loadu_pd( lanes + lane_px * n + i );
+                __m256d py = _mm256_loadu_pd( lanes + lane_py * n + i );
+                __m256d dx = _mm256_loadu_pd( lanes + lane_dx * n + i );
+                __m256d dy = _mm256_loadu_pd( lanes + lane_dy * n + i );
+
+                __m256d centre = _mm256_sub_pd( _mm256_mul_pd( dy, _mm256_sub_pd( cx, _mm256_add_pd( px, px ))),
+                                                _mm256_mul_pd( dx, _mm256_sub_pd( cy, _mm256_add_pd( py, py ))));
+                __m256d spread = _mm256_add_pd( _mm256_mul_pd( _mm256_andnot_pd( sign, dy ), w ),
+                                                _mm256_mul_pd( _mm256_andnot_pd( sign, dx ), h ));
+
+                __m256d hit = _mm256_and_pd( _mm256_and_pd( _mm256_cmp_pd( _mm256_loadu_pd( lanes + lane_max_x * n + i ), vx0, _CMP_GE_OQ ),
+                                                            _mm256_cmp_pd( _mm256_loadu_pd( lanes + lane_min_x * n + i ), vx1, _CMP_LE_OQ )),
+                                             _mm256_and_pd( _mm256_cmp_pd( _mm256_loadu_pd( lanes + lane_max_y * n + i ), vy0, _CMP_GE_OQ ),
+                                                            _mm256_cmp_pd( _mm256_loadu_pd( lanes + lane_min_y * n + i ), vy1, _CMP_LE_OQ )));
+
+                hit = _mm256_and_pd( hit, _mm256_cmp_pd( _mm256_andnot_pd( sign, centre ), spread, _CMP_LE_OQ ));
+
+                mask |= unsigned( _mm256_movemask_pd( hit )) << i;
+            }
+
+            for ( ; i < n; ++i )
+            {
+                mask |= unsigned( lane_touches( lanes, n, i, x0, y0, x1, y1 )) << i;
+            }
+
+            return mask;
+        }
+    };
+
+#endif
+}
+
+/**
+ * A packet of up to N line segments, held as one array per coordinate, so
+ * that a rectangle can be tested against all of them together.
+ *
+ * The test is that of has_intersect( line_segment, rectangle ), done with
+ * the same arithmetic lane by lane, so the two agree. Lanes beyond size()
+ * hold zero length segments at the origin; callers mask them off.
+ */
+template< typename T, int N >
+class segment_packet
+{
+public:
+
+    typedef typename intersect_type< T >::type  wide_type;
+
+    segment_packet()
+
+        : m_size( 0 )
+    {
+        std::fill( m_lanes, m_lanes + detail::lane_arrays * N, wide_type() );
+    }
+
+    int size() const    { return m_size; }
+
+    void push_back( const line_segment< T > & l )
+    {
+        const int i = m_size++;
+
+        const wide_type px = l.p1().x();
+        const wide_type py = l.p1().y();
+        const wide_type dx = wide_type( l.p2().x() ) - px;
+        const wide_type dy = wide_type( l.p2().y() ) - py;
+
+        lane( detail::lane_px, i ) = px;
+        lane( detail::lane_py, i ) = py;
+        lane( detail::lane_dx, i ) = dx;
+        lane( detail::lane_dy, i ) = dy;
+        lane( detail::lane_min_x, i ) = std::min( px, px + dx );
+        lane( detail::lane_min_y, i ) = std::min( py, py + dy );
+        lane( detail::lane_max_x, i ) = std::max( px, px + dx );
+        lane( detail::lane_max_y, i ) = std::max( py, py + dy );
+    }
+
+    /**
+     * The direction of segment i, as ( dx < 0 ) | ( dy < 0 ) << 1.
+     */
+    int direction( int i ) const
+    {
+        return ( m_lanes[ detail::lane_dx * N + i ] < 0 ) | ( m_lanes[ detail::lane_dy * N + i ] < 0 ) << 1;
+    }
+
+    /**
+     * @return A bitmask with bit i set if segment i touches r.
+     */
+    unsigned touches( const rectangle< T > & r ) const
+    {
+        const wide_type x0 = r.x();
+        const wide_type y0 = r.y();
+        const wide_type x1 = x0 + r.width();
+        const wide_type y1 = y0 + r.height();
+
+        return detail::packet_touches< wide_type >()( m_lanes, N, x0, y0, x1, y1 );
+    }
+
+private:
+
+    wide_type & lane( int array, int i )
+    {
+        return m_lanes[ array * N + i ];
+    }
+
+    wide_type   m_lanes[ detail::lane_arrays * N ];
+    int         m_size;
+};
+
+#endif // QUADTREE_SEGMENT_PACKET_H
@@ -0,0 +1,140 @@
+#ifndef QUADTREE_SMALL_CONTAINERS_H
+#define QUADTREE_SMALL_CONTAINERS_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * @namespace detail
+ */
+namespace detail
+{
+    /**
+     * A LIFO stack which holds up to N elements inline, and only falls back
+     * to the heap if it grows beyond that. Used for the iterative traversals,
+     * where the depth of a tree bounds the number of pending nodes.
+     */
+    template< typename T, std::size_t N >
+    class small_stack
+    {
+    public:
+
+        small_stack()
+
+            : m_size( 0 )
+        {}
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        void push( const T & v )
+        {
+            if ( m_size < N )
+                m_inline[ m_size ] = v;
+            else
+                m_overflow.push_back( v );
+
+            ++m_size;
+        }
+
+        T pop()
+        {
+            --m_size;
+
+            if ( m_size < N )
+                return m_inline[ m_size ];
+
+            T v = m_overflow.back();
+            m_overflow.pop_back();
+            return v;
+        }
+
+    private:
+
+        std::array< T, N >  m_inline;
+        std::size_t         m_size;
+        std::vector< T >    m_overflow;
+    };
+
+    /**
+     * A priority queue (largest under Compare on top, as std::priority_queue)
+     * which holds up to N elements inline, and only moves them to the heap
+     * if it grows beyond that. Used for the best-first traversals.
+     */
+    template< typename T, std::size_t N, typename Compare = std::less< T > >
+    class small_priority_queue
+    {
+    public:
+
+        small_priority_queue()
+
+            : m_size( 0 )
+        {}
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        std::size_t size() const
+        {
+            return m_size;
+        }
+
+        const T & top() const
+        {
+            return data()[ 0 ];
+        }
+
+        void push( const T & v )
+        {
+            if ( m_overflow.empty() && m_size < N )
+            {
+                m_inline[ m_size ] = v;
+            }
+            else
+            {
+                // once spilled, the overflow holds every element
+                if ( m_overflow.empty() )
+                    m_overflow.assign( m_inline.begin(), m_inline.end() );
+
+                m_overflow.push_back( v );
+            }
+
+            ++m_size;
+            std::push_heap( data(), data() + m_size, Compare() );
+        }
+
+        void pop()
+        {
+            std::pop_heap( data(), data() + m_size, Compare() );
+            --m_size;
+
+            if ( !m_overflow.empty() )
+                m_overflow.pop_back();
+        }
+
+    private:
+
+        T * data()
+        {
+            return m_overflow.empty() ? m_inline.data() : m_overflow.data();
+        }
+
+        const T * data() const
+        {
+            return m_overflow.empty() ? m_inline.data() : m_overflow.data();
+        }
+
+        std::array< T, N >  m_inline;
+        std::size_t         m_size;
+        std::vector< T >    m_overflow;
+    };
+}
+
+#endif // QUADTREE_SMALL_CONTAINERS_H
@@ -0,0 +1,229 @@
+#ifndef QUADTREE_SNAPSHOT_TREE_H
+#define QUADTREE_SNAPSHOT_TREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ *
+ * snapshot_tree publishes immutable versions of a tree (a quad_tree, say)
+ * to any number of reader threads, while a single writer thread builds
+ * and publishes the next version.
+ *
+ * The current version is held by an atomic pointer, which the writer
+ * swaps; readers never block or retry, and always see one whole version.
+ * Replaced versions are reclaimed through epochs: each reader announces
+ * the epoch at which it started reading, and a version retired at epoch e
+ * is deleted once no reader which might hold it (one announcing e or
+ * earlier) is still reading.
+ *
+ * Each reading thread claims a reader (one of max_readers slots) for as
+ * long as it reads.
+ *
+ */
+template< typename Tree_type >
+class snapshot_tree
+{
+public:
+
+    typedef Tree_type                                   tree_type;
+
+    explicit snapshot_tree( std::unique_ptr< tree_type > initial, unsigned max_readers = 64 )
+
+        : m_current( initial.release() )
+        , m_epoch( 1 )
+        , m_slots( new reader_slot[ max_readers ] )
+        , m_slot_count( max_readers )
+    {
+    }
+
+    snapshot_tree( const snapshot_tree & ) = delete;
+    snapshot_tree & operator=( const snapshot_tree & ) = delete;
+
+    /**
+     * Every reader must have been released by now.
+     */
+    ~snapshot_tree()
+    {
+        for ( const retired_version & r : m_retired )
+        {
+            delete r.first;
+        }
+
+        delete m_current.load();
+    }
+
+    /**
+     * @brief reader
+     *
+     * A reading thread's claim on one of the reader slots. Not to be shared
+     * between threads, though a thread may hold several.
+     */
+    class reader
+    {
+    public:
+
+        explicit reader( snapshot_tree & s )
+
+            : m_slot( s.claim() )
+            , m_tree( s )
+        {
+        }
+
+        ~reader()
+        {
+            m_slot->claimed.store( false, std::memory_order_release );
+        }
+
+        reader( const reader & ) = delete;
+        reader & operator=( const reader & ) = delete;
+
+        /**
+         * Calls f( const tree_type & ) with the current version, which stays
+         * alive until f returns. Nested calls are not allowed.
+         */
+        template< typename Function >
+        void read( const Function & f ) const
+        {
+            // announced before the version is loaded, so that a writer which
+            // retires it cannot miss this reader
+            m_slot->epoch.store( m_tree.m_epoch.load() );
+
+            const tree_type * t = m_tree.m_current.load();
+
+            f( *t );
+
+            m_slot->epoch.store( quiescent, std::memory_order_release );
+        }
+
+    private:
+
+        typename snapshot_tree::reader_slot *   m_slot;
+        const snapshot_tree &                   m_tree;
+    };
+
+    /**
+     * The current version. Only for the writer (or while there are no
+     * readers): it may be reclaimed once replaced.
+     */
+    const tree_type & current() const
+    {
+        return *m_current.load();
+    }
+
+    /**
+     * Publishes next as the current version, retiring the one it replaces,
+     * then reclaims whatever retired versions no reader can still hold.
+     * Writer only.
+     */
+    void publish( std::unique_ptr< tree_type > next )
+    {
+        const tree_type * old = m_current.exchange( next.release() );
+
+        // readers announcing a later epoch loaded their version after the
+        // exchange above, so cannot hold old
+        m_retired.push_back( retired_version( old, m_epoch.fetch_add( 1 )));
+
+        reclaim();
+    }
+
+    /**
+     * Builds the next version from the given constructor arguments and
+     * publishes it. Writer only.
+     */
+    template< typename... Args >
+    void emplace( Args &&... args )
+    {
+        publish( std::unique_ptr< tree_type >( new tree_type( std::forward< Args >( args )... )));
+    }
+
+    /**
+     * Deletes the retired versions which no reader can still hold. Writer
+     * only; publish() calls this, but a writer may call it again once
+     * readers have moved on.
+     *
+     * @return The number of versions still awaiting reclamation.
+     */
+    std::size_t reclaim()
+    {
+        std::uint64_t oldest = std::numeric_limits< std::uint64_t >::max();
+
+        for ( unsigned i = 0; i < m_slot_count; ++i )
+        {
+            const std::uint64_t e = m_slots[ i ].epoch.load();
+
+            if ( e != quiescent && e < oldest )
+                oldest = e;
+        }
+
+        std::size_t kept = 0;
+
+        for ( std::size_t i = 0; i < m_retired.size(); ++i )
+        {
+            if ( m_retired[ i ].second < oldest )
+                delete m_retired[ i ].first;
+            else
+                m_retired[ kept++ ] = m_retired[ i ];
+        }
+
+        m_retired.resize( kept );
+
+        return kept;
+    }
+
+private:
+
+    // the epoch of a reader which is not reading
+    enum : std::uint64_t { quiescent = 0 };
+
+    /**
+     * A reader's announced epoch, written by a different thread on every
+     * read. The slots come from new[], which only promises 16-byte
+     * alignment, so each is padded to two 64-byte cache lines: the epochs
+     * of neighbouring slots are then 128 bytes apart and never share a
+     * line, wherever the array starts.
+     */
+    struct reader_slot
+    {
+        reader_slot()
+
+            : epoch( quiescent )
+            , claimed( false )
+        {
+        }
+
+        std::atomic< std::uint64_t >    epoch;
+        std::atomic< bool >             claimed;
+        char                            padding[ 128 - sizeof( std::atomic< std::uint64_t > ) - sizeof( std::atomic< bool > ) ];
+    };
+
+    // a replaced version, and the epoch at which it was retired
+    typedef std::pair< const tree_type *, std::uint64_t >  retired_version;
+
+    reader_slot * claim()
+    {
+        for ( unsigned i = 0; i < m_slot_count; ++i )
+        {
+            bool expected = false;
+
+            if ( m_slots[ i ].claimed.compare_exchange_strong( expected, true, std::memory_order_acquire ))
+                return &m_slots[ i ];
+        }
+
+        throw std::runtime_error( "snapshot_tree: every reader slot is in use" );
+    }
+
+    std::atomic< const tree_type * >    m_current;
+    std::atomic< std::uint64_t >        m_epoch;
+    std::unique_ptr< reader_slot[] >    m_slots;
+    unsigned                            m_slot_count;
+    std::vector< retired_version >      m_retired;
+};
+
+#endif // QUADTREE_SNAPSHOT_TREE_H